@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include "ControlSocket.h"
+#include "TrafficPi.h"
+
+/*
+ * Network commands and telemetry, see ControlSocket.h
+*/
+#define maxWatchers 8
+#define telemetryPoll 20 // ms between looks for a state change to stream
+
+static int Socket_Fd = -1;
+static int Stop_Fd = -1; // eventfd written by stopControlSocket()
+static pthread_t Socket_Thread;
+static bool Thread_Running = false;
+static char Unix_Path[sizeof(((sockaddr_un *)0)->sun_path)] = ""; // removed on stop, empty for UDP
+
+struct Watcher {
+    sockaddr_storage address;
+    socklen_t length;
+};
+static Watcher Watchers[maxWatchers];
+static int Watcher_Count = 0;
+static char Last_Telemetry[256] = ""; // last line streamed, cleared to resend
+
+static void reply(const sockaddr_storage &_address, socklen_t _length, const char *_text) {
+    // a client that has gone away is not our problem, drop the reply
+    sendto(Socket_Fd, _text, strlen(_text), MSG_DONTWAIT, (const sockaddr *)&_address, _length);
+}
+
+static int findWatcher(const sockaddr_storage &_address, socklen_t _length) {
+    for (int i = 0; i < Watcher_Count; i++) {
+        if (Watchers[i].length == _length && memcmp(&Watchers[i].address, &_address, _length) == 0)
+            return i;
+    }
+    return -1;
+}
+
+static const char *handleCommand(const char *_text, const sockaddr_storage &_address, socklen_t _length) {
+    ControlCommand _command = {};
+    char _name[16];
+    int _used = 0;
+    if (sscanf(_text, " %15s %n", _name, &_used) != 1)
+        return "error unknown command\n";
+    const char *_arguments = _text + _used;
+    char _extra;
+
+    if (strcmp(_name, "mode") == 0) {
+        if (sscanf(_arguments, "%d %c", &_command.value, &_extra) != 1)
+            return "error expected mode <position>\n";
+        _command.type = commandMode;
+    } else if (strcmp(_name, "bias") == 0) {
+        if (sscanf(_arguments, "%d %d %d %c", &_command.head, &_command.value, &_command.value2, &_extra) != 3)
+            return "error expected bias <head> <on> <off>\n";
+        _command.type = commandBias;
+    } else if (strcmp(_name, "watch") == 0 && *_arguments == '\0') {
+        if (findWatcher(_address, _length) >= 0)
+            return "ok\n";
+        if (Watcher_Count >= maxWatchers)
+            return "error too many watchers\n";
+        Watchers[Watcher_Count].address = _address;
+        Watchers[Watcher_Count].length = _length;
+        Watcher_Count++;
+        Last_Telemetry[0] = '\0'; // send the current state straight away
+        return "ok\n";
+    } else if (strcmp(_name, "unwatch") == 0 && *_arguments == '\0') {
+        int i = findWatcher(_address, _length);
+        if (i >= 0)
+            Watchers[i] = Watchers[--Watcher_Count];
+        return "ok\n";
+    } else {
+        return "error unknown command\n";
+    }
+
+    switch (queueCommand(_command))
+    {
+    case 0:
+        return "ok\n";
+    case -2:
+        return "error busy\n";
+    default:
+        return "error bad value\n";
+    }
+}
+
+static void readCommands(void) {
+    char _text[128];
+    for (;;) {
+        sockaddr_storage _address;
+        socklen_t _length = sizeof(_address);
+        ssize_t _size = recvfrom(Socket_Fd, _text, sizeof(_text) - 1, MSG_DONTWAIT, (sockaddr *)&_address, &_length);
+        if (_size < 0)
+            return; // nothing left to read
+        _text[_size] = '\0';
+        reply(_address, _length, handleCommand(_text, _address, _length));
+    }
+}
+
+static void streamTelemetry(void) {
+    char _text[sizeof(Last_Telemetry)];
+    int _length = formatTelemetry(_text, sizeof(_text));
+    if (strcmp(_text, Last_Telemetry) == 0)
+        return; // no change
+    strcpy(Last_Telemetry, _text);
+    for (int i = 0; i < Watcher_Count; i++)
+        sendto(Socket_Fd, _text, _length, MSG_DONTWAIT, (const sockaddr *)&Watchers[i].address, Watchers[i].length);
+}
+
+static void *socketThread(void *) {
+    int _epoll = epoll_create1(0);
+    epoll_event _event = {};
+    _event.events = EPOLLIN;
+    _event.data.fd = Socket_Fd;
+    epoll_ctl(_epoll, EPOLL_CTL_ADD, Socket_Fd, &_event);
+    _event.data.fd = Stop_Fd;
+    epoll_ctl(_epoll, EPOLL_CTL_ADD, Stop_Fd, &_event);
+
+    for (;;) {
+        epoll_event _events[2];
+        int _count = epoll_wait(_epoll, _events, 2, telemetryPoll);
+        bool _stop = false;
+        for (int i = 0; i < _count; i++) {
+            if (_events[i].data.fd == Stop_Fd)
+                _stop = true;
+            else
+                readCommands();
+        }
+        if (_stop)
+            break;
+        if (Watcher_Count)
+            streamTelemetry();
+    }
+    close(_epoll);
+    return NULL;
+}
+
+static int openSocket(const char *_address) {
+    char *_end;
+    long _port = strtol(_address, &_end, 10);
+    if (*_address && *_end == '\0') {
+        if (_port <= 0 || _port > 65535)
+            return -1;
+        int _fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        sockaddr_in _bind = {};
+        _bind.sin_family = AF_INET;
+        _bind.sin_addr.s_addr = htonl(INADDR_ANY);
+        _bind.sin_port = htons((uint16_t)_port);
+        if (_fd >= 0 && bind(_fd, (const sockaddr *)&_bind, sizeof(_bind)) < 0) {
+            close(_fd);
+            return -1;
+        }
+        return _fd;
+    }
+
+    if (strlen(_address) >= sizeof(Unix_Path))
+        return -1;
+    int _fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    sockaddr_un _bind = {};
+    _bind.sun_family = AF_UNIX;
+    strcpy(_bind.sun_path, _address);
+    unlink(_address); // left behind by a run that did not stop cleanly
+    if (_fd >= 0 && bind(_fd, (const sockaddr *)&_bind, sizeof(_bind)) < 0) {
+        close(_fd);
+        return -1;
+    }
+    strcpy(Unix_Path, _address);
+    return _fd;
+}
+
+int startControlSocket(const char *_address) {
+    Socket_Fd = openSocket(_address);
+    if (Socket_Fd < 0) {
+        printf("could not open control socket %s\n", _address);
+        return -1;
+    }
+    Stop_Fd = eventfd(0, EFD_CLOEXEC);
+    Thread_Running = Stop_Fd >= 0 && pthread_create(&Socket_Thread, NULL, socketThread, NULL) == 0;
+    if (!Thread_Running) {
+        printf("could not start control socket thread\n");
+        stopControlSocket();
+        return -1;
+    }
+    return 0;
+}
+
+void stopControlSocket(void) {
+    if (Thread_Running) {
+        uint64_t _one = 1;
+        if (write(Stop_Fd, &_one, sizeof(_one)) == sizeof(_one))
+            pthread_join(Socket_Thread, NULL);
+        Thread_Running = false;
+    }
+    if (Stop_Fd >= 0)
+        close(Stop_Fd);
+    if (Socket_Fd >= 0)
+        close(Socket_Fd);
+    if (Unix_Path[0])
+        unlink(Unix_Path);
+    Stop_Fd = Socket_Fd = -1;
+    Unix_Path[0] = '\0';
+}
@@ -0,0 +1,24 @@
+#ifndef CONTROL_SOCKET_H
+#define CONTROL_SOCKET_H
+
+/*
+ * CONTROL SOCKET
+ * 	A datagram endpoint served by one epoll thread, started with -n.
+ * 		A number is a UDP port on every interface, anything else is the
+ * 		path of a Unix datagram socket (clients must bind their own
+ * 		socket to get replies).
+ * 	One command per datagram, each is answered with "ok" or "error ...":
+ * 		mode <position>			run the profile of a dial position
+ * 		bias <head> <on> <off>		set a head's BIAS_ON/BIAS_OFF masks (0-7)
+ * 		watch / unwatch			start/stop streaming state changes
+ * 	Watchers are sent a formatTelemetry() line each time the state changes.
+ * 	Commands go to the controller through queueCommand(), the network
+ * 		thread never touches the lights or the GPIO backend.
+*/
+
+// opens the socket and starts the thread, -1 on failure
+int startControlSocket(const char *_address);
+// stops the thread and closes the socket
+void stopControlSocket(void);
+
+#endif
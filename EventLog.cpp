@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "EventLog.h"
+
+/*
+ * Memory mapped event ring, see EventLog.h
+*/
+#define eventLogBytes (sizeof(EventLogHeader) + eventLogRecords * sizeof(EventRecord))
+
+static EventLogHeader *Event_Log = NULL; // NULL when not logging
+static EventRecord *Event_Records = NULL;
+
+int openEventLog(const char *_path) {
+    int _fd = open(_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (_fd < 0 || ftruncate(_fd, eventLogBytes) < 0) {
+        printf("could not create event log %s\n", _path);
+        if (_fd >= 0)
+            close(_fd);
+        return -1;
+    }
+    void *_map = mmap(NULL, eventLogBytes, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+    close(_fd); // the mapping keeps the file open
+    if (_map == MAP_FAILED) {
+        printf("could not map event log %s\n", _path);
+        return -1;
+    }
+
+    // the file was just truncated so everything is already zero
+    EventLogHeader *_header = (EventLogHeader *)_map;
+    memcpy(_header->magic, eventLogMagic, sizeof(_header->magic));
+    _header->recordSize = sizeof(EventRecord);
+    _header->recordCount = eventLogRecords;
+    Event_Records = (EventRecord *)(_header + 1);
+    Event_Log = _header;
+    return 0;
+}
+
+void closeEventLog(void) {
+    if (!Event_Log)
+        return;
+    EventLogHeader *_header = Event_Log;
+    Event_Log = NULL;
+    munmap(_header, eventLogBytes);
+}
+
+void logEvent(int _type, int _pin, int _level, int _value, uint32_t _bits, uint32_t _tick) {
+    if (!Event_Log)
+        return;
+
+    // the alert and timer threads both log, so claim a slot first
+    uint64_t _n = Event_Log->next.fetch_add(1, std::memory_order_relaxed);
+    EventRecord &_record = Event_Records[_n & (eventLogRecords - 1)];
+    _record.sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release); // a reader sees 0 before any new field
+    _record.tick = _tick;
+    _record.bits = _bits;
+    _record.type = (uint8_t)_type;
+    _record.pin = (uint8_t)_pin;
+    _record.level = (uint8_t)_level;
+    _record.value = (uint8_t)_value;
+    _record.sequence.store((uint32_t)_n + 1, std::memory_order_release);
+}
@@ -0,0 +1,78 @@
+#ifndef EVENT_LOG_H
+#define EVENT_LOG_H
+
+#include <stdint.h>
+#include <atomic>
+
+/*
+ * EVENT LOG
+ * 	When started with -e <file> the inputs setup() read, then every mode
+ * 		dial edge, bias switch edge and lamp change are written as packed
+ * 		records into a ring in a memory mapped file. Writing a record is
+ * 		a fetch_add and a few stores, no allocation and no syscalls, so
+ * 		it is safe from the callbacks.
+ * 	Other processes can map the same file read only and follow it while
+ * 		the controller runs, see EventLogDump.cpp. The file is a header
+ * 		followed by eventLogRecords records, record n is at n % eventLogRecords.
+ * 	Each record's sequence is written 0 first and n + 1 last, a reader
+ * 		checks it before and after copying a record and skips any that
+ * 		changed under it.
+ * 	A log is also a trace, TrafficPiReplay.cpp sets the simulated pins to
+ * 		its startup levels, feeds its inputs back through the controller
+ * 		and checks the lamp changes against a golden log.
+*/
+#define eventLogMagic "TPEVLOG1"
+#define eventLogRecords 65536 // must be a power of two, 1 MiB of records
+
+// record types
+#define eventMode 1 // pin = mode pin, value = profile selected
+#define eventOnBias 2 // pin, level = ON bias switch edge
+#define eventOffBias 3 // pin, level = OFF bias switch edge
+#define eventLamp 4 // head, bits = bank bits now lit on that head
+#define eventFault 5 // pin = failed lamp, value = head
+#define eventWatchdog 6 // value = ms the scheduler had not ticked for, the safe state was sent
+#define eventPreempt 7 // pin, level = preemption edge, value = head sent green, bits = lights written
+#define eventStartup 8 // pin, level = 1 if the dial was on mode pin pin, value = its position, bits = input levels setup() read
+
+struct EventRecord {
+    std::atomic<uint32_t> sequence; // low 32 bits of n + 1, 0 while being written
+    uint32_t tick; // gpioTick() of the event
+    uint32_t bits; // lamp bank bits, for edges every lamp lit at the time
+    uint8_t type;
+    uint8_t pin; // GPIO, or head for eventLamp
+    uint8_t level;
+    uint8_t value;
+};
+static_assert(sizeof(EventRecord) == 16, "records are packed into 16 bytes");
+
+struct EventLogHeader {
+    char magic[8];
+    uint32_t recordSize; // sizeof(EventRecord)
+    uint32_t recordCount; // eventLogRecords
+    std::atomic<uint64_t> next; // records ever written, the next one goes at next % recordCount
+    uint8_t reserved[40]; // keeps the records on a cache line boundary
+};
+static_assert(sizeof(EventLogHeader) == 64, "header is one cache line");
+
+// creates or truncates the log file and maps it, -1 on failure
+int openEventLog(const char *_path);
+void closeEventLog(void);
+
+// adds a record, does nothing when no log is open
+void logEvent(int _type, int _pin, int _level, int _value, uint32_t _bits, uint32_t _tick);
+
+// for readers of a mapped log, copies record n if it is still in the ring and was not being written
+inline bool readEventRecord(const EventRecord *_records, uint64_t _n, EventRecord &_copy) {
+    const EventRecord &_record = _records[_n & (eventLogRecords - 1)];
+    uint32_t _sequence = _record.sequence.load(std::memory_order_acquire);
+    _copy.tick = _record.tick;
+    _copy.bits = _record.bits;
+    _copy.type = _record.type;
+    _copy.pin = _record.pin;
+    _copy.level = _record.level;
+    _copy.value = _record.value;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return _sequence == (uint32_t)_n + 1 && _record.sequence.load(std::memory_order_relaxed) == _sequence;
+}
+
+#endif
@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "EventLog.h"
+
+/*
+ * Prints the records of a TrafficPi -e event log, reading the mapped file
+ * directly so it can run alongside the controller.
+ * build: g++ -O2 -std=c++17 EventLogDump.cpp -o EventLogDump
+ * usage: EventLogDump <file> [-f]
+ * 	-f keeps following the log like tail -f
+*/
+
+#define countOf(_array) ((int)(sizeof(_array) / sizeof((_array)[0])))
+
+const char *EVENT_NAMES[] = { "?", "mode", "onBias", "offBias", "lamp", "fault", "watchdog", "preempt", "startup" };
+
+int main(int argc, char **argv)
+{
+    if (argc < 2 || (argc > 2 && strcmp(argv[2], "-f") != 0)) {
+        printf("usage: %s <file> [-f]\n", argv[0]);
+        return 1;
+    }
+    bool follow = argc > 2;
+
+    int fd = open(argv[1], O_RDONLY);
+    size_t bytes = sizeof(EventLogHeader) + eventLogRecords * sizeof(EventRecord);
+    void *map = fd >= 0 ? mmap(NULL, bytes, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    if (map == MAP_FAILED) {
+        printf("could not map %s\n", argv[1]);
+        return 1;
+    }
+    const EventLogHeader *header = (const EventLogHeader *)map;
+    if (memcmp(header->magic, eventLogMagic, sizeof(header->magic)) != 0
+        || header->recordSize != sizeof(EventRecord) || header->recordCount != eventLogRecords) {
+        printf("%s is not an event log from this build\n", argv[1]);
+        return 1;
+    }
+    const EventRecord *records = (const EventRecord *)(header + 1);
+
+    uint64_t next = header->next.load(std::memory_order_acquire);
+    uint64_t n = next > eventLogRecords ? next - eventLogRecords : 0; // oldest still in the ring
+    for (;;) {
+        for (; n < next; n++) {
+            EventRecord record;
+            if (!readEventRecord(records, n, record)) {
+                printf("%llu lost\n", (unsigned long long)n); // overwritten or still being written
+                continue;
+            }
+            printf("%llu %10u %-8s pin %2d level %d value %d bits %08x\n", (unsigned long long)n, record.tick,
+                EVENT_NAMES[record.type < countOf(EVENT_NAMES) ? record.type : 0], record.pin, record.level, record.value, record.bits);
+        }
+        if (!follow)
+            break;
+        fflush(stdout);
+        usleep(100000);
+        next = header->next.load(std::memory_order_acquire);
+        if (next - n > eventLogRecords)
+            n = next - eventLogRecords; // fell behind, skip to the oldest still there
+    }
+    return 0;
+}
@@ -0,0 +1,66 @@
+#ifndef GPIO_BACKEND_H
+#define GPIO_BACKEND_H
+
+#include <stdint.h>
+
+/*
+ * GPIO BACKEND
+ * 	Everything the controller needs from the hardware goes through the
+ * 		backend that Gpio points at, so the same controller logic can run
+ * 		on the Pi (PigpioBackend) or off it against a virtual clock
+ * 		(SimulatedBackend, see SimBackend.h).
+ * 	The calls mirror the pigpio functions they replace, see the pigpio
+ * 		documentation for the details of each.
+*/
+
+// alert callback, level 0 = falling edge, 1 = rising edge, 2 = watchdog timeout
+typedef void (*GpioAlertFunction) (int _pin, int _level, uint32_t _tick);
+// timer callback
+typedef void (*GpioTimerFunction) (void);
+
+// one step of a wave: bank bits to set, bank bits to clear, then wait
+#define maxWavePulses 64
+struct GpioPulse {
+    uint32_t onBits;
+    uint32_t offBits;
+    uint32_t usDelay;
+};
+
+struct GpioBackend {
+    const char *name;
+
+    int (*initialise)(void); // < 0 on failure
+    void (*terminate)(void);
+
+    void (*setOutput)(int _pin);
+    void (*setInput)(int _pin); // input with the pull up on
+    void (*setSenseInput)(int _pin); // input with the pull down on
+    void (*setGlitchFilter)(int _pin, unsigned _steady); // gpioGlitchFilter()
+    void (*setAlert)(int _pin, GpioAlertFunction _function); // gpioSetAlertFunc()
+    void (*setWatchdog)(int _pin, unsigned _timeout); // gpioSetWatchdog(), ms, 0 = off
+    void (*setTimer)(int _timer, unsigned _millis, GpioTimerFunction _function); // gpioSetTimerFunc()
+
+    int (*read)(int _pin); // gpioRead()
+    uint32_t (*readBank)(void); // gpioRead_Bits_0_31()
+    void (*setBank)(uint32_t _bits); // gpioWrite_Bits_0_31_Set()
+    void (*clearBank)(uint32_t _bits); // gpioWrite_Bits_0_31_Clear()
+    void (*writeBank)(uint32_t _clearBits, uint32_t _setBits); // clear then set, the backend may do both in one go
+    uint32_t (*tick)(void); // gpioTick(), microseconds
+
+    // replaces any wave being sent with _pulses on repeat, < 0 on failure
+    int (*sendWave)(const GpioPulse *_pulses, int _count);
+    void (*stopWave)(void);
+    // builds _pulses into a wave that is kept ready and not sent, < 0 on failure
+    int (*armWave)(const GpioPulse *_pulses, int _count);
+    // sends the armed wave on repeat in place of anything else, safe from any thread
+    void (*sendArmedWave)(void);
+};
+
+// the backend in use, set before setup() is called
+extern const GpioBackend *Gpio;
+
+extern const GpioBackend PigpioBackend; // PigpioBackend.cpp
+extern const GpioBackend SimulatedBackend; // SimBackend.cpp
+extern const GpioBackend PigpiodBackend; // PigpiodBackend.cpp
+
+#endif
@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include "MetricsExporter.h"
+#include "TrafficPi.h"
+
+/*
+ * Prometheus metrics over HTTP, see MetricsExporter.h
+*/
+#define metricsBufferSize 4096
+#define scrapeTimeout 200 // ms a scraper has to send its request
+
+static int Listen_Fd = -1;
+static int Stop_Fd = -1; // eventfd written by stopMetrics()
+static pthread_t Metrics_Thread;
+static bool Thread_Running = false;
+
+static char Response[metricsBufferSize + 128]; // headers and metrics, ready to send
+static int Response_Length = 0;
+static timespec Formatted_At = { 0, 0 };
+
+static void refreshResponse(void) {
+    timespec _now;
+    clock_gettime(CLOCK_MONOTONIC, &_now);
+    long _age = (_now.tv_sec - Formatted_At.tv_sec) * 1000 + (_now.tv_nsec - Formatted_At.tv_nsec) / 1000000;
+    if (Response_Length && _age < metricsRefresh)
+        return; // still fresh
+    Formatted_At = _now;
+
+    char _metrics[metricsBufferSize];
+    int _length = formatMetrics(_metrics, sizeof(_metrics));
+    Response_Length = snprintf(Response, sizeof(Response),
+        "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %d\r\n\r\n%s", _length, _metrics);
+}
+
+// one scrape, the request is read and thrown away so closing does not reset the connection
+static void serveScrape(void) {
+    int _fd = accept4(Listen_Fd, NULL, NULL, SOCK_CLOEXEC);
+    if (_fd < 0)
+        return;
+    timeval _timeout = { 0, scrapeTimeout * 1000 };
+    setsockopt(_fd, SOL_SOCKET, SO_RCVTIMEO, &_timeout, sizeof(_timeout));
+    setsockopt(_fd, SOL_SOCKET, SO_SNDTIMEO, &_timeout, sizeof(_timeout));
+    char _request[1024];
+    if (recv(_fd, _request, sizeof(_request), 0) > 0) {
+        refreshResponse();
+        if (send(_fd, Response, Response_Length, MSG_NOSIGNAL) == Response_Length)
+            shutdown(_fd, SHUT_WR);
+    }
+    close(_fd);
+}
+
+static void *metricsThread(void *) {
+    sched_param _param = {};
+    if (pthread_setschedparam(pthread_self(), SCHED_IDLE, &_param) != 0)
+        printf("metrics: could not move to SCHED_IDLE, scrapes run at normal priority\n");
+
+    int _epoll = epoll_create1(0);
+    epoll_event _event = {};
+    _event.events = EPOLLIN;
+    _event.data.fd = Listen_Fd;
+    epoll_ctl(_epoll, EPOLL_CTL_ADD, Listen_Fd, &_event);
+    _event.data.fd = Stop_Fd;
+    epoll_ctl(_epoll, EPOLL_CTL_ADD, Stop_Fd, &_event);
+
+    for (;;) {
+        epoll_event _events[2];
+        int _count = epoll_wait(_epoll, _events, 2, -1);
+        bool _stop = false;
+        for (int i = 0; i < _count; i++) {
+            if (_events[i].data.fd == Stop_Fd)
+                _stop = true;
+            else
+                serveScrape();
+        }
+        if (_stop)
+            break;
+    }
+    close(_epoll);
+    return NULL;
+}
+
+int startMetrics(const char *_port) {
+    char *_end;
+    long _number = strtol(_port, &_end, 10);
+    if (!*_port || *_end != '\0' || _number <= 0 || _number > 65535) {
+        printf("metrics port must be a number, not %s\n", _port);
+        return -1;
+    }
+    Listen_Fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int _reuse = 1;
+    sockaddr_in _bind = {};
+    _bind.sin_family = AF_INET;
+    _bind.sin_addr.s_addr = htonl(INADDR_ANY);
+    _bind.sin_port = htons((uint16_t)_number);
+    if (Listen_Fd < 0 || setsockopt(Listen_Fd, SOL_SOCKET, SO_REUSEADDR, &_reuse, sizeof(_reuse)) < 0
+        || bind(Listen_Fd, (const sockaddr *)&_bind, sizeof(_bind)) < 0 || listen(Listen_Fd, 8) < 0) {
+        printf("could not open metrics port %s\n", _port);
+        stopMetrics();
+        return -1;
+    }
+    Stop_Fd = eventfd(0, EFD_CLOEXEC);
+    Thread_Running = Stop_Fd >= 0 && pthread_create(&Metrics_Thread, NULL, metricsThread, NULL) == 0;
+    if (!Thread_Running) {
+        printf("could not start metrics thread\n");
+        stopMetrics();
+        return -1;
+    }
+    return 0;
+}
+
+void stopMetrics(void) {
+    if (Thread_Running) {
+        uint64_t _one = 1;
+        if (write(Stop_Fd, &_one, sizeof(_one)) == sizeof(_one))
+            pthread_join(Metrics_Thread, NULL);
+        Thread_Running = false;
+    }
+    if (Stop_Fd >= 0)
+        close(Stop_Fd);
+    if (Listen_Fd >= 0)
+        close(Listen_Fd);
+    Stop_Fd = Listen_Fd = -1;
+    Response_Length = 0;
+}
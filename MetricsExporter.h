@@ -0,0 +1,21 @@
+#ifndef METRICS_EXPORTER_H
+#define METRICS_EXPORTER_H
+
+/*
+ * METRICS EXPORTER
+ * 	Serves formatMetrics() over HTTP for Prometheus, started with -M <port>.
+ * 		Any request on the port is answered with the metrics, so a scrape
+ * 		of /metrics works as well as anything else.
+ * 	The thread runs under SCHED_IDLE so a scrape only ever gets the time
+ * 		the timing callbacks leave over. The text is formatted at most
+ * 		once every metricsRefresh ms, every scrape in between is sent the
+ * 		same buffer.
+*/
+#define metricsRefresh 1000 // ms
+
+// opens the port and starts the thread, -1 on failure
+int startMetrics(const char *_port);
+// stops the thread and closes the port
+void stopMetrics(void);
+
+#endif
@@ -0,0 +1,276 @@
+#include <stdio.h>
+#include <pthread.h>
+#include <pigpio.h>
+#include "PigpioBackend.h"
+
+/*
+ * GPIO backend for the Pi, a thin wrapper over the in-process pigpio library.
+ * See PigpioBackend.h for the input modes.
+*/
+#define pigpioPins 32
+
+static int Input_Mode = inputAlerts;
+static unsigned Sample_Rate = defaultSampleRate;
+
+// only used with inputInterrupts and inputSamples
+static GpioAlertFunction Alert_Functions[pigpioPins];
+static unsigned Watchdog_Timeout[pigpioPins]; // ms, 0 = off
+
+int pigpioConfigure(int _input, unsigned _sampleRate) {
+    if (_sampleRate != 1 && _sampleRate != 2 && _sampleRate != 4
+        && _sampleRate != 5 && _sampleRate != 8 && _sampleRate != 10)
+        return -1;
+    Input_Mode = _input;
+    Sample_Rate = _sampleRate;
+    return 0;
+}
+
+static int pigpioInitialise(void) {
+    // main() handles SIGINT/SIGTERM itself, stop pigpio installing its handlers
+    gpioCfgSetInternals(gpioCfgGetInternals() | PI_CFG_NOSIGHANDLER);
+    gpioCfgClock(Sample_Rate, PI_DEFAULT_CLK_PERIPHERAL, 0);
+    return gpioInitialise();
+}
+
+static void pigpioTerminate(void) {
+    gpioTerminate();
+}
+
+static void pigpioSetOutput(int _pin) {
+    gpioSetMode(_pin, PI_OUTPUT);
+}
+
+static void pigpioSetInput(int _pin) {
+    gpioSetMode(_pin, PI_INPUT);
+    gpioSetPullUpDown(_pin, PI_PUD_UP);
+}
+
+static void pigpioSetSenseInput(int _pin) {
+    gpioSetMode(_pin, PI_INPUT);
+    gpioSetPullUpDown(_pin, PI_PUD_DOWN);
+}
+
+static void pigpioSetGlitchFilter(int _pin, unsigned _steady) {
+    gpioGlitchFilter(_pin, _steady);
+}
+
+/*
+ * With inputInterrupts pigpio runs each pin's ISR on its own thread, they
+ * all go through here so the controller still sees one callback at a time.
+*/
+static pthread_mutex_t Interrupt_Lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void interruptDispatch(int _pin, int _level, uint32_t _tick) {
+    pthread_mutex_lock(&Interrupt_Lock);
+    if (Alert_Functions[_pin])
+        Alert_Functions[_pin](_pin, _level == PI_TIMEOUT ? 2 : _level, _tick);
+    pthread_mutex_unlock(&Interrupt_Lock);
+}
+
+/*
+ * With inputSamples every sample of the input pins since the last call
+ * arrives in one batch. Each one is compared with the last levels and any
+ * pin that changed gets its callback, then watchdogs that have run out
+ * are fired as level 2 the same as pigpio's.
+*/
+static uint32_t Sample_Bits = 0; // input pins being sampled
+static uint32_t Sample_Levels = 0; // levels of those pins at the last sample
+static uint32_t Watchdog_Bits = 0; // pins with a watchdog running
+static uint32_t Watchdog_Due[pigpioPins];
+
+static void sampleDispatch(const gpioSample_t *_samples, int _count) {
+    for (int i = 0; i < _count; i++) {
+        uint32_t _changed = (_samples[i].level ^ Sample_Levels) & Sample_Bits;
+        Sample_Levels ^= _changed;
+        while (_changed) {
+            int _pin = __builtin_ctz(_changed);
+            _changed &= _changed - 1;
+            if (Watchdog_Bits & (1u << _pin))
+                Watchdog_Due[_pin] = _samples[i].tick + Watchdog_Timeout[_pin] * 1000; // an edge restarts the watchdog
+            Alert_Functions[_pin](_pin, (Sample_Levels >> _pin) & 1, _samples[i].tick);
+        }
+    }
+
+    uint32_t _now = _count ? _samples[_count - 1].tick : gpioTick();
+    uint32_t _running = Watchdog_Bits;
+    while (_running) {
+        int _pin = __builtin_ctz(_running);
+        _running &= _running - 1;
+        if ((int32_t)(_now - Watchdog_Due[_pin]) < 0)
+            continue;
+        Watchdog_Due[_pin] = _now + Watchdog_Timeout[_pin] * 1000;
+        Alert_Functions[_pin](_pin, 2, _now);
+    }
+}
+
+static void pigpioSetAlert(int _pin, GpioAlertFunction _function) {
+    switch (Input_Mode)
+    {
+    default:
+    case inputAlerts:
+        gpioSetAlertFunc(_pin, _function);
+        break;
+
+    case inputInterrupts:
+        Alert_Functions[_pin] = _function;
+        gpioSetISRFunc(_pin, EITHER_EDGE, Watchdog_Timeout[_pin], _function ? interruptDispatch : NULL);
+        break;
+
+    case inputSamples:
+        gpioSetGetSamplesFunc(NULL, 0); // stop the batches while the pins change
+        Alert_Functions[_pin] = _function;
+        if (_function)
+            Sample_Bits |= 1u << _pin;
+        else
+            Sample_Bits &= ~(1u << _pin);
+        Sample_Levels = gpioRead_Bits_0_31() & Sample_Bits;
+        if (Sample_Bits)
+            gpioSetGetSamplesFunc(sampleDispatch, Sample_Bits);
+        break;
+    }
+}
+
+static void pigpioSetWatchdog(int _pin, unsigned _timeout) {
+    switch (Input_Mode)
+    {
+    default:
+    case inputAlerts:
+        gpioSetWatchdog(_pin, _timeout);
+        break;
+
+    case inputInterrupts:
+        Watchdog_Timeout[_pin] = _timeout;
+        if (Alert_Functions[_pin])
+            gpioSetISRFunc(_pin, EITHER_EDGE, _timeout, interruptDispatch); // the ISR timeout is the watchdog
+        break;
+
+    case inputSamples:
+        // only called from inside a callback, so never at the same time as sampleDispatch()
+        Watchdog_Timeout[_pin] = _timeout;
+        Watchdog_Due[_pin] = gpioTick() + _timeout * 1000;
+        if (_timeout)
+            Watchdog_Bits |= 1u << _pin;
+        else
+            Watchdog_Bits &= ~(1u << _pin);
+        break;
+    }
+}
+
+static void pigpioSetTimer(int _timer, unsigned _millis, GpioTimerFunction _function) {
+    gpioSetTimerFunc(_timer, _millis, _function);
+}
+
+static int pigpioRead(int _pin) {
+    return gpioRead(_pin);
+}
+
+static uint32_t pigpioReadBank(void) {
+    return gpioRead_Bits_0_31();
+}
+
+static void pigpioSetBank(uint32_t _bits) {
+    gpioWrite_Bits_0_31_Set(_bits);
+}
+
+static void pigpioClearBank(uint32_t _bits) {
+    gpioWrite_Bits_0_31_Clear(_bits);
+}
+
+static void pigpioWriteBank(uint32_t _clearBits, uint32_t _setBits) {
+    gpioWrite_Bits_0_31_Clear(_clearBits);
+    gpioWrite_Bits_0_31_Set(_setBits);
+}
+
+static uint32_t pigpioTick(void) {
+    return gpioTick();
+}
+
+/*
+ * Builds the pulses into a new wave and sends it on repeat. The new wave
+ * takes over straight away, then the old one is deleted.
+*/
+static int Wave_Id = -1; // wave being sent, -1 when there is none
+
+static int pigpioSendWave(const GpioPulse *_pulses, int _count) {
+    if (_count > maxWavePulses)
+        return PI_TOO_MANY_PULSES;
+
+    gpioPulse_t _wavePulses[maxWavePulses];
+    for (int i = 0; i < _count; i++) {
+        _wavePulses[i].gpioOn = _pulses[i].onBits;
+        _wavePulses[i].gpioOff = _pulses[i].offBits;
+        _wavePulses[i].usDelay = _pulses[i].usDelay;
+    }
+
+    gpioWaveAddNew(); //start a fresh pulse list
+    gpioWaveAddGeneric(_count, _wavePulses);
+    int _wave = gpioWaveCreate();
+    if (_wave < 0)
+        return _wave; // leave the old wave running
+    gpioWaveTxSend(_wave, PI_WAVE_MODE_REPEAT);
+
+    if (Wave_Id >= 0)
+        gpioWaveDelete(Wave_Id); //old wave is no longer being sent
+    Wave_Id = _wave;
+    return 0;
+}
+
+static void pigpioStopWave(void) {
+    gpioWaveTxStop();
+}
+
+/*
+ * The armed wave is created up front so sending it is one call with nothing
+ * to build, even when the rest of the program has stopped.
+*/
+static int Armed_Wave = -1;
+
+static int pigpioArmWave(const GpioPulse *_pulses, int _count) {
+    if (_count > maxWavePulses)
+        return PI_TOO_MANY_PULSES;
+
+    gpioPulse_t _wavePulses[maxWavePulses];
+    for (int i = 0; i < _count; i++) {
+        _wavePulses[i].gpioOn = _pulses[i].onBits;
+        _wavePulses[i].gpioOff = _pulses[i].offBits;
+        _wavePulses[i].usDelay = _pulses[i].usDelay;
+    }
+
+    gpioWaveAddNew();
+    gpioWaveAddGeneric(_count, _wavePulses);
+    int _wave = gpioWaveCreate();
+    if (_wave < 0)
+        return _wave;
+    if (Armed_Wave >= 0)
+        gpioWaveDelete(Armed_Wave);
+    Armed_Wave = _wave;
+    return 0;
+}
+
+static void pigpioSendArmedWave(void) {
+    if (Armed_Wave >= 0)
+        gpioWaveTxSend(Armed_Wave, PI_WAVE_MODE_REPEAT);
+}
+
+const GpioBackend PigpioBackend = {
+    "pigpio",
+    pigpioInitialise,
+    pigpioTerminate,
+    pigpioSetOutput,
+    pigpioSetInput,
+    pigpioSetSenseInput,
+    pigpioSetGlitchFilter,
+    pigpioSetAlert,
+    pigpioSetWatchdog,
+    pigpioSetTimer,
+    pigpioRead,
+    pigpioReadBank,
+    pigpioSetBank,
+    pigpioClearBank,
+    pigpioWriteBank,
+    pigpioTick,
+    pigpioSendWave,
+    pigpioStopWave,
+    pigpioArmWave,
+    pigpioSendArmedWave,
+};
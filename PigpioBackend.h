@@ -0,0 +1,30 @@
+#ifndef PIGPIO_BACKEND_H
+#define PIGPIO_BACKEND_H
+
+#include "GpioBackend.h"
+
+/*
+ * PIGPIO INPUTS
+ * 	How PigpioBackend delivers input edges to the alert callbacks:
+ * 	inputAlerts	gpioSetAlertFunc(), pigpio's sampler reports each edge,
+ * 			the glitch filter applies. The default.
+ * 	inputInterrupts	gpioSetISRFunc(), kernel edge interrupts. No glitch
+ * 			filter, watchdogs become the ISR timeout.
+ * 	inputSamples	gpioSetGetSamplesFunc(), one callback a millisecond
+ * 			with every sample of the input pins, edges are found
+ * 			and dispatched in one pass. No glitch filter, watchdogs
+ * 			are checked at each batch.
+ * 	The sample rate sets how often pigpio's sampler reads the pins (and the
+ * 		DMA pacing of waves), 1, 2, 4, 5, 8 or 10 microseconds. With
+ * 		inputInterrupts nothing needs the sampler to be fast.
+ * 	Callbacks are never run on more than one thread at a time in any mode.
+*/
+#define inputAlerts 0
+#define inputInterrupts 1
+#define inputSamples 2
+#define defaultSampleRate 5 // microseconds, pigpio's default
+
+// must be called before initialise, returns -1 for a sample rate pigpio does not support
+int pigpioConfigure(int _input, unsigned _sampleRate);
+
+#endif
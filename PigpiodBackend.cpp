@@ -0,0 +1,320 @@
+#include <time.h>
+#include <pthread.h>
+#include <atomic>
+#include <pigpiod_if2.h>
+#include "PigpiodBackend.h"
+
+/*
+ * GPIO backend over a pigpiod daemon, see PigpiodBackend.h
+*/
+#define pigpiodPins 32
+#define pigpiodTimers 10 // the same timers 0-9 as pigpio
+#define tickOffsetPeriod 10000 // ms between measurements of the daemon's clock
+#define tickOffsetSamples 3 // round trips per measurement, the quickest is kept
+
+static const char *Daemon_Host = NULL;
+static const char *Daemon_Port = NULL;
+static int Pi = -1; // pigpiod_if2 connection
+
+void pigpiodConfigure(const char *_host, const char *_port) {
+    Daemon_Host = _host;
+    Daemon_Port = _port;
+}
+
+static uint32_t localTick(void) {
+    timespec _now;
+    clock_gettime(CLOCK_MONOTONIC, &_now);
+    return (uint32_t)(_now.tv_sec * 1000000ull + _now.tv_nsec / 1000); // wraps like the real tick
+}
+
+static int Armed_Wave = -1; // safe state wave, created up front so sending it is one round trip
+
+/*
+ * Edge ticks are the daemon's gpioTick(), moved onto localTick() so edge
+ * latency can be measured against the scheduler. The two clocks drift
+ * apart, so the offset is measured again every tickOffsetPeriod ms.
+*/
+static std::atomic<uint32_t> Tick_Offset(0); // local tick - daemon tick
+
+static void measureTickOffset(void) {
+    uint32_t _best = UINT32_MAX;
+    uint32_t _offset = 0;
+    for (int i = 0; i < tickOffsetSamples; i++) {
+        uint32_t _before = localTick();
+        uint32_t _daemon = get_current_tick(Pi);
+        uint32_t _after = localTick();
+        if (_after - _before < _best) {
+            _best = _after - _before; // the quickest round trip pins the daemon's tick closest
+            _offset = _before + (_after - _before) / 2 - _daemon;
+        }
+    }
+    Tick_Offset.store(_offset, std::memory_order_relaxed);
+}
+
+static GpioAlertFunction Alert_Functions[pigpiodPins];
+static int Callback_Ids[pigpiodPins];
+
+static void pigpiodAlert(int _pi, unsigned _pin, unsigned _level, uint32_t _tick) {
+    GpioAlertFunction _function = Alert_Functions[_pin];
+    if (_function)
+        _function(_pin, _level == PI_TIMEOUT ? 2 : _level, _tick + Tick_Offset.load(std::memory_order_relaxed));
+}
+
+/*
+ * Timers wait for their deadline on a condition variable, so stopping or
+ * changing one wakes its thread straight away instead of waiting out the
+ * period.
+*/
+struct RemoteTimer {
+    pthread_t thread;
+    bool running;
+    bool stop; // under lock
+    pthread_mutex_t lock;
+    pthread_cond_t wake; // on CLOCK_MONOTONIC
+    unsigned millis;
+    GpioTimerFunction function;
+};
+static RemoteTimer Timers[pigpiodTimers];
+static RemoteTimer Offset_Timer; // keeps Tick_Offset up to date
+
+static void initialiseTimer(RemoteTimer &_remoteTimer) {
+    pthread_condattr_t _attributes;
+    pthread_condattr_init(&_attributes);
+    pthread_condattr_setclock(&_attributes, CLOCK_MONOTONIC);
+    pthread_cond_init(&_remoteTimer.wake, &_attributes);
+    pthread_condattr_destroy(&_attributes);
+    pthread_mutex_init(&_remoteTimer.lock, NULL);
+}
+
+static void *timerThread(void *_timer) {
+    RemoteTimer &_remoteTimer = *(RemoteTimer *)_timer;
+    uint64_t _period = _remoteTimer.millis * 1000000ull; // ns
+    timespec _due;
+    clock_gettime(CLOCK_MONOTONIC, &_due);
+    for (;;) {
+        uint64_t _next = _due.tv_nsec + _period;
+        _due.tv_sec += _next / 1000000000;
+        _due.tv_nsec = _next % 1000000000;
+        pthread_mutex_lock(&_remoteTimer.lock);
+        while (!_remoteTimer.stop && pthread_cond_timedwait(&_remoteTimer.wake, &_remoteTimer.lock, &_due) == 0) {
+        }
+        bool _stop = _remoteTimer.stop;
+        pthread_mutex_unlock(&_remoteTimer.lock);
+        if (_stop)
+            break;
+        _remoteTimer.function();
+
+        timespec _now;
+        clock_gettime(CLOCK_MONOTONIC, &_now);
+        if (_now.tv_sec > _due.tv_sec + 1)
+            _due = _now; // fell far behind, start again from now rather than run a burst
+    }
+    return NULL;
+}
+
+static void startTimer(RemoteTimer &_remoteTimer, unsigned _millis, GpioTimerFunction _function) {
+    _remoteTimer.millis = _millis;
+    _remoteTimer.function = _function;
+    _remoteTimer.stop = false;
+    _remoteTimer.running = pthread_create(&_remoteTimer.thread, NULL, timerThread, &_remoteTimer) == 0;
+}
+
+static void stopTimer(RemoteTimer &_remoteTimer) {
+    if (!_remoteTimer.running)
+        return;
+    pthread_mutex_lock(&_remoteTimer.lock);
+    _remoteTimer.stop = true;
+    pthread_cond_signal(&_remoteTimer.wake);
+    pthread_mutex_unlock(&_remoteTimer.lock);
+    pthread_join(_remoteTimer.thread, NULL);
+    _remoteTimer.running = false;
+}
+
+static int pigpiodInitialise(void) {
+    Pi = pigpio_start(Daemon_Host, Daemon_Port);
+    if (Pi < 0)
+        return Pi;
+
+    static bool _timersReady = false;
+    if (!_timersReady) {
+        for (RemoteTimer &_remoteTimer : Timers)
+            initialiseTimer(_remoteTimer);
+        initialiseTimer(Offset_Timer);
+        _timersReady = true;
+    }
+    measureTickOffset();
+    startTimer(Offset_Timer, tickOffsetPeriod, measureTickOffset);
+
+    for (int &_id : Callback_Ids)
+        _id = -1;
+    return 0;
+}
+
+static void pigpiodTerminate(void) {
+    for (RemoteTimer &_remoteTimer : Timers)
+        stopTimer(_remoteTimer);
+    stopTimer(Offset_Timer);
+    for (int i = 0; i < pigpiodPins; i++) {
+        if (Callback_Ids[i] >= 0)
+            callback_cancel(Callback_Ids[i]);
+        Callback_Ids[i] = -1;
+        Alert_Functions[i] = NULL;
+    }
+    Armed_Wave = -1; // waves go with the connection
+    pigpio_stop(Pi);
+    Pi = -1;
+}
+
+static void pigpiodSetOutput(int _pin) {
+    set_mode(Pi, _pin, PI_OUTPUT);
+}
+
+static void pigpiodSetInput(int _pin) {
+    set_mode(Pi, _pin, PI_INPUT);
+    set_pull_up_down(Pi, _pin, PI_PUD_UP);
+}
+
+static void pigpiodSetSenseInput(int _pin) {
+    set_mode(Pi, _pin, PI_INPUT);
+    set_pull_up_down(Pi, _pin, PI_PUD_DOWN);
+}
+
+static void pigpiodSetGlitchFilter(int _pin, unsigned _steady) {
+    set_glitch_filter(Pi, _pin, _steady);
+}
+
+static void pigpiodSetAlert(int _pin, GpioAlertFunction _function) {
+    Alert_Functions[_pin] = _function;
+    if (_function && Callback_Ids[_pin] < 0)
+        Callback_Ids[_pin] = callback(Pi, _pin, EITHER_EDGE, pigpiodAlert);
+    else if (!_function && Callback_Ids[_pin] >= 0) {
+        callback_cancel(Callback_Ids[_pin]);
+        Callback_Ids[_pin] = -1;
+    }
+}
+
+static void pigpiodSetWatchdog(int _pin, unsigned _timeout) {
+    set_watchdog(Pi, _pin, _timeout);
+}
+
+static void pigpiodSetTimer(int _timer, unsigned _millis, GpioTimerFunction _function) {
+    RemoteTimer &_remoteTimer = Timers[_timer];
+    stopTimer(_remoteTimer);
+    if (!_function)
+        return;
+    startTimer(_remoteTimer, _millis, _function);
+}
+
+static int pigpiodRead(int _pin) {
+    return gpio_read(Pi, _pin);
+}
+
+static uint32_t pigpiodReadBank(void) {
+    return read_bank_1(Pi);
+}
+
+static void pigpiodSetBank(uint32_t _bits) {
+    set_bank_1(Pi, _bits);
+}
+
+static void pigpiodClearBank(uint32_t _bits) {
+    clear_bank_1(Pi, _bits);
+}
+
+/*
+ * Two calls, each answered once the daemon has written the bank, so a
+ * commit has reached the lamps when it returns and a later one can never
+ * land before it. A stored script would be one round trip but run_script()
+ * answers as soon as the script starts.
+*/
+static void pigpiodWriteBank(uint32_t _clearBits, uint32_t _setBits) {
+    clear_bank_1(Pi, _clearBits);
+    set_bank_1(Pi, _setBits);
+}
+
+static uint32_t pigpiodTick(void) {
+    return localTick();
+}
+
+/*
+ * The same as PigpioBackend's waves, built on the daemon.
+*/
+static int Wave_Id = -1; // wave being sent, -1 when there is none
+
+static int pigpiodSendWave(const GpioPulse *_pulses, int _count) {
+    if (_count > maxWavePulses)
+        return PI_TOO_MANY_PULSES;
+
+    gpioPulse_t _wavePulses[maxWavePulses];
+    for (int i = 0; i < _count; i++) {
+        _wavePulses[i].gpioOn = _pulses[i].onBits;
+        _wavePulses[i].gpioOff = _pulses[i].offBits;
+        _wavePulses[i].usDelay = _pulses[i].usDelay;
+    }
+
+    wave_add_new(Pi); //start a fresh pulse list
+    wave_add_generic(Pi, _count, _wavePulses);
+    int _wave = wave_create(Pi);
+    if (_wave < 0)
+        return _wave; // leave the old wave running
+    wave_send_repeat(Pi, _wave);
+
+    if (Wave_Id >= 0)
+        wave_delete(Pi, Wave_Id); //old wave is no longer being sent
+    Wave_Id = _wave;
+    return 0;
+}
+
+static void pigpiodStopWave(void) {
+    wave_tx_stop(Pi);
+}
+
+static int pigpiodArmWave(const GpioPulse *_pulses, int _count) {
+    if (_count > maxWavePulses)
+        return PI_TOO_MANY_PULSES;
+
+    gpioPulse_t _wavePulses[maxWavePulses];
+    for (int i = 0; i < _count; i++) {
+        _wavePulses[i].gpioOn = _pulses[i].onBits;
+        _wavePulses[i].gpioOff = _pulses[i].offBits;
+        _wavePulses[i].usDelay = _pulses[i].usDelay;
+    }
+
+    wave_add_new(Pi);
+    wave_add_generic(Pi, _count, _wavePulses);
+    int _wave = wave_create(Pi);
+    if (_wave < 0)
+        return _wave;
+    if (Armed_Wave >= 0)
+        wave_delete(Pi, Armed_Wave);
+    Armed_Wave = _wave;
+    return 0;
+}
+
+static void pigpiodSendArmedWave(void) {
+    if (Armed_Wave >= 0)
+        wave_send_repeat(Pi, Armed_Wave);
+}
+
+const GpioBackend PigpiodBackend = {
+    "pigpiod",
+    pigpiodInitialise,
+    pigpiodTerminate,
+    pigpiodSetOutput,
+    pigpiodSetInput,
+    pigpiodSetSenseInput,
+    pigpiodSetGlitchFilter,
+    pigpiodSetAlert,
+    pigpiodSetWatchdog,
+    pigpiodSetTimer,
+    pigpiodRead,
+    pigpiodReadBank,
+    pigpiodSetBank,
+    pigpiodClearBank,
+    pigpiodWriteBank,
+    pigpiodTick,
+    pigpiodSendWave,
+    pigpiodStopWave,
+    pigpiodArmWave,
+    pigpiodSendArmedWave,
+};
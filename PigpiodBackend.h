@@ -0,0 +1,25 @@
+#ifndef PIGPIOD_BACKEND_H
+#define PIGPIOD_BACKEND_H
+
+#include "GpioBackend.h"
+
+/*
+ * PIGPIOD BACKEND
+ * 	Drives the pins through a pigpiod daemon with pigpiod_if2, so the
+ * 		controller does not need to run as root or even on the Pi.
+ * 	Every call is a round trip over the daemon's socket, so the hot paths
+ * 		are kept short:
+ * 		- a light commit is a clear and a set, two round trips that have
+ * 		  both reached the pins when it returns
+ * 		- tick() is a local clock, edge ticks from the daemon are moved
+ * 		  onto it with an offset measured every few seconds
+ * 		- edges arrive on pigpiod_if2's notification stream, all on its
+ * 		  one callback thread
+ * 	pigpiod has no timer callbacks, timers are local threads that sleep to
+ * 		absolute deadlines.
+*/
+
+// must be called before initialise, NULL for pigpiod_if2's defaults (localhost, 8888)
+void pigpiodConfigure(const char *_host, const char *_port);
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef PIN_MAP_H
+#define PIN_MAP_H
+
+#include <stdint.h>
+
+/*
+ * PIN MAPS
+ * 	Everything the controller derives from a head's pins, the bank bits lit
+ * 		by each 3 bit light request, the bias switch bits and the bank
+ * 		bits the head takes up, comes from the constexpr functions here.
+ * 	addHead() runs them on the pins of a -p pin map when it is read.
+ * 		BoardWiring runs them at compile time on a wiring fixed in the
+ * 		source and static_asserts that it can be used, so a board is
+ * 		checked when it is built and its tables are constants. The
+ * 		default head in TrafficPi.cpp is a BoardWiring, a clash there
+ * 		fails the build instead of starting with no head, and setup()
+ * 		adds it from its tables without working them out again.
+ * 	Pins are in pin map file order,
+ * 		red amber green [redOn redOff amberOn amberOff greenOn greenOff]
+ * 		noPin where there is none.
+*/
+#define noPin -1
+#define userPins 28 // GPIO 0-27 are on the header
+
+// bit of each light in a 3 bit request (red << amber << green), in red, amber, green order
+constexpr int LIGHT_MASK_BITS[] = { 0b100, 0b010, 0b001 };
+
+// bank bit of a pin, 0 for noPin
+constexpr uint32_t pinBit(int _pin) {
+    return _pin == noPin ? 0 : 1u << _pin;
+}
+
+// bank bits of a list of pins
+constexpr uint32_t pinBits(const int *_pins, int _count) {
+    uint32_t _bits = 0;
+    for (int i = 0; i < _count; i++)
+        _bits |= pinBit(_pins[i]);
+    return _bits;
+}
+
+// true if every pin is a user GPIO (or noPin) used once and none are in _taken
+constexpr bool pinsUsable(const int *_pins, int _count, uint32_t _taken) {
+    for (int i = 0; i < _count; i++) {
+        if (_pins[i] == noPin)
+            continue;
+        if (_pins[i] < 0 || _pins[i] >= userPins || (_taken & pinBit(_pins[i])))
+            return false;
+        _taken |= pinBit(_pins[i]);
+    }
+    return true;
+}
+
+// bank bits lit by each 3 bit request, indexed by the request
+struct LightBits {
+    uint32_t bits[8];
+    constexpr uint32_t operator[](int _request) const { return bits[_request]; }
+};
+
+constexpr LightBits lightBitsFor(const int *_lights) {
+    LightBits _table = {};
+    for (int _request = 0; _request < 8; _request++) {
+        for (int i = 0; i < 3; i++) {
+            if (_request & LIGHT_MASK_BITS[i])
+                _table.bits[_request] |= pinBit(_lights[i]);
+        }
+    }
+    return _table;
+}
+
+/*
+ * A head wired at compile time, e.g. for a board with the lights on 5 6 13:
+ * 	typedef BoardWiring<5, 6, 13, 17, 27, 22, 10, 9, 11> SecondBoard;
+ * _taken is the bank bits of the other inputs (mode dial, preemption) it
+ * must stay clear of.
+*/
+template <int _red, int _amber, int _green,
+    int _redOn, int _redOff, int _amberOn, int _amberOff, int _greenOn, int _greenOff,
+    uint32_t _taken = 0>
+struct BoardWiring {
+    static constexpr int pins[9] = { _red, _amber, _green, _redOn, _redOff, _amberOn, _amberOff, _greenOn, _greenOff };
+    static constexpr int pinCount = _redOn == noPin ? 3 : 9;
+    static constexpr LightBits lightBits = lightBitsFor(pins);
+    static constexpr uint32_t pinsUsed = pinBits(pins, pinCount);
+
+    static_assert(_red != noPin && _amber != noPin && _green != noPin, "a head needs all three lights");
+    static_assert(pinCount == 3 || (_redOff != noPin && _amberOn != noPin && _amberOff != noPin
+        && _greenOn != noPin && _greenOff != noPin), "a head has all six bias switches or none");
+    static_assert(pinsUsable(pins, pinCount, _taken), "pins must be user GPIOs, each used once and clear of the other inputs");
+};
+
+#endif
@@ -0,0 +1,215 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "SequenceProgram.h"
+
+/*
+ * Compiles a text sequence description into a program for TrafficPi -x,
+ * see SequenceProgram.h for the binary and TrafficPi.seq for an example.
+ * build: g++ -O2 -std=c++17 SequenceCompiler.cpp -o SequenceCompiler
+ * usage: SequenceCompiler <source> <program>
+ *
+ * 	sequence <name>			start a sequence, then one step per line:
+ * 		<mask> [ms] [nobias]	3 binary digits red amber green, e.g. 100
+ * 		random [ms]		a random pattern for a random time
+ * 	end
+ * 	position <n> <name> [ms ...]	what dial position n runs, the durations
+ * 					are used in turn (repeating) by steps
+ * 					that have none of their own
+ * 	Anything after a # is ignored. Every position from 0 up to the
+ * 	highest one used must be given. Steps last at most maxStepMillis,
+ * 	random ones maxRandomStepMillis, see SequenceProgram.h.
+*/
+#define maxSequences 32
+#define maxSequenceLength 64
+#define maxDurations 16
+
+// number of elements in an array
+#define countOf(_array) ((int)(sizeof(_array) / sizeof((_array)[0])))
+
+struct SourceStep {
+    uint8_t output;
+    uint8_t flags;
+    long millis; // 0 when the position gives it
+};
+
+struct SourceSequence {
+    char name[32];
+    SourceStep steps[maxSequenceLength];
+    int length;
+};
+
+SourceSequence Sequences[maxSequences];
+int Sequence_Count = 0;
+
+ProgramHeader Header;
+ProgramStep Steps[maxProgramSteps];
+bool Position_Given[programPositions];
+
+int fail(const char *_path, int _line, const char *_message) {
+    printf("%s:%d: %s\n", _path, _line, _message);
+    return 1;
+}
+
+const SourceSequence *findSequence(const char *_name) {
+    for (int i = 0; i < Sequence_Count; i++) {
+        if (strcmp(Sequences[i].name, _name) == 0)
+            return &Sequences[i];
+    }
+    return NULL;
+}
+
+// parses "100" style masks, -1 if it is not three binary digits
+int parseMask(const char *_text) {
+    if (strlen(_text) != 3)
+        return -1;
+    int _mask = 0;
+    for (int i = 0; i < 3; i++) {
+        if (_text[i] != '0' && _text[i] != '1')
+            return -1;
+        _mask = (_mask << 1) | (_text[i] - '0');
+    }
+    return _mask;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3) {
+        printf("usage: %s <source> <program>\n", argv[0]);
+        return 1;
+    }
+    const char *path = argv[1];
+    FILE *source = fopen(path, "r");
+    if (!source) {
+        printf("could not open %s\n", path);
+        return 1;
+    }
+
+    char line[256];
+    int lineNumber = 0;
+    SourceSequence *open = NULL; // sequence being read
+    int highest = -1;
+    while (fgets(line, sizeof(line), source)) {
+        lineNumber++;
+        char *comment = strchr(line, '#');
+        if (comment)
+            *comment = '\0';
+
+        char *words[maxDurations + 3];
+        int wordCount = 0;
+        for (char *word = strtok(line, " \t\r\n"); word; word = strtok(NULL, " \t\r\n")) {
+            if (wordCount >= countOf(words))
+                return fail(path, lineNumber, "too many words");
+            words[wordCount++] = word;
+        }
+        if (wordCount == 0)
+            continue;
+
+        if (open) {
+            if (strcmp(words[0], "end") == 0 && wordCount == 1) {
+                if (open->length == 0)
+                    return fail(path, lineNumber, "sequence has no steps");
+                open = NULL;
+                continue;
+            }
+            if (open->length >= maxSequenceLength)
+                return fail(path, lineNumber, "sequence is too long");
+            SourceStep &step = open->steps[open->length++];
+            step = { 0, 0, 0 };
+            int mask = parseMask(words[0]);
+            if (strcmp(words[0], "random") == 0)
+                step.flags |= stepRandom;
+            else if (mask >= 0)
+                step.output = (uint8_t)mask;
+            else
+                return fail(path, lineNumber, "expected a step mask like 100 or random");
+            for (int i = 1; i < wordCount; i++) {
+                if (strcmp(words[i], "nobias") == 0)
+                    step.flags |= stepNoBias;
+                else if ((step.millis = strtol(words[i], NULL, 10)) <= 0)
+                    return fail(path, lineNumber, "expected milliseconds or nobias");
+            }
+            continue;
+        }
+
+        if (strcmp(words[0], "sequence") == 0 && wordCount == 2) {
+            if (findSequence(words[1]) || Sequence_Count >= maxSequences || strlen(words[1]) >= sizeof(open->name))
+                return fail(path, lineNumber, "sequence name already used, too long or too many sequences");
+            open = &Sequences[Sequence_Count++];
+            strcpy(open->name, words[1]);
+            open->length = 0;
+        } else if (strcmp(words[0], "position") == 0 && wordCount >= 3) {
+            int position = atoi(words[1]);
+            const SourceSequence *sequence = findSequence(words[2]);
+            if (position < 0 || position >= programPositions || Position_Given[position])
+                return fail(path, lineNumber, "bad or repeated position");
+            if (!sequence)
+                return fail(path, lineNumber, "no sequence of that name above");
+
+            long durations[maxDurations];
+            int durationCount = 0;
+            for (int i = 3; i < wordCount; i++) {
+                if ((durations[durationCount++] = strtol(words[i], NULL, 10)) <= 0)
+                    return fail(path, lineNumber, "durations must be milliseconds");
+            }
+
+            // each position gets its own copy of the sequence with every duration resolved
+            int first = Header.stepCount;
+            if (first + sequence->length > maxProgramSteps)
+                return fail(path, lineNumber, "program is too long");
+            for (int i = 0; i < sequence->length; i++) {
+                const SourceStep &step = sequence->steps[i];
+                long millis = step.millis ? step.millis : durationCount ? durations[i % durationCount] : 0;
+                long longest = (step.flags & stepRandom) ? maxRandomStepMillis : maxStepMillis;
+                if (millis <= 0 || millis > longest)
+                    return fail(path, lineNumber, "a step has no duration, or one longer than the controller can time");
+                ProgramStep &out = Steps[first + i];
+                out.output = step.output;
+                out.flags = step.flags;
+                out.next = (uint16_t)(first + (i + 1) % sequence->length);
+                out.micros = (uint32_t)(millis * 1000);
+            }
+            Header.stepCount += sequence->length;
+            Header.entry[position] = (uint16_t)first;
+            Position_Given[position] = true;
+            if (position > highest)
+                highest = position;
+        } else {
+            return fail(path, lineNumber, "expected sequence or position");
+        }
+    }
+    fclose(source);
+    if (open)
+        return fail(path, lineNumber, "sequence has no end");
+    for (int i = 0; i <= highest; i++) {
+        if (!Position_Given[i]) {
+            printf("%s: position %d is not given\n", path, i);
+            return 1;
+        }
+    }
+    if (highest < 0)
+        return fail(path, lineNumber, "no positions given");
+
+    memcpy(Header.magic, programMagic, sizeof(Header.magic));
+    Header.version = programVersion;
+    Header.positions = (uint16_t)(highest + 1);
+    Header.checksum = programChecksum(Steps, Header.stepCount);
+
+    // written beside the program then renamed over it, a controller that has
+    // the old one mapped keeps reading the old file until it remaps
+    char temporary[512];
+    snprintf(temporary, sizeof(temporary), "%s.new", argv[2]);
+    FILE *program = fopen(temporary, "wb");
+    bool written = program && fwrite(&Header, sizeof(Header), 1, program) == 1
+        && fwrite(Steps, sizeof(ProgramStep), Header.stepCount, program) == Header.stepCount;
+    if (program && fclose(program) != 0)
+        written = false;
+    if (!written || rename(temporary, argv[2]) != 0) {
+        printf("could not write %s\n", argv[2]);
+        remove(temporary);
+        return 1;
+    }
+    printf("%s: %d positions, %d steps, %zu bytes\n", argv[2], Header.positions, Header.stepCount,
+        sizeof(Header) + Header.stepCount * sizeof(ProgramStep));
+    return 0;
+}
@@ -0,0 +1,67 @@
+#ifndef SEQUENCE_PROGRAM_H
+#define SEQUENCE_PROGRAM_H
+
+#include <stdint.h>
+
+/*
+ * SEQUENCE PROGRAMS
+ * 	A program is the whole light behaviour as data, compiled from a text
+ * 		description by SequenceCompiler (see TrafficPi.seq for the built
+ * 		in behaviour written that way) and mapped by the controller with
+ * 		-x <file>.
+ * 	The file is a ProgramHeader followed by stepCount ProgramSteps. Each
+ * 		dial position has an entry step, each step says what to show,
+ * 		for how long and which step comes next, so a head running a
+ * 		program only ever fetches one record per step.
+ * 	All values are little endian, the same as the Pi.
+*/
+#define programMagic "TPPROG01"
+#define programVersion 1
+#define programPositions 16 // room in the header, the controller uses one per mode pin
+#define maxProgramSteps 4096
+
+/*
+ * Longest steps the controller can time, shared with SequenceCompiler.
+ * Deadlines are compared as signed 32 bit differences of the microsecond
+ * tick, so every step, random ones at their longest, must stay well under
+ * 2^31 us (35.8 minutes).
+*/
+#define maxStepMillis 1800000 // 30 minutes
+#define maxRandomSteps 8 // most times its own length a random step may last
+#define maxRandomStepMillis (maxStepMillis / maxRandomSteps)
+static_assert(maxStepMillis * 1000ull < (1ull << 31), "steps must fit a signed 32 bit tick difference");
+
+// step flags
+#define stepNoBias 0x01 // show the output as it is, the bias switches are ignored
+#define stepRandom 0x02 // random pattern, lasting 1 to PARTY_MAX_STEPS times micros
+
+struct ProgramStep {
+    uint8_t output; // 3 bit light pattern (red << amber << green)
+    uint8_t flags;
+    uint16_t next; // step shown after this one
+    uint32_t micros; // how long it is shown
+};
+static_assert(sizeof(ProgramStep) == 8, "steps are 8 byte records");
+
+struct ProgramHeader {
+    char magic[8];
+    uint16_t version;
+    uint16_t positions; // dial positions with an entry
+    uint16_t stepCount;
+    uint16_t reserved;
+    uint32_t checksum; // programChecksum() of the steps
+    uint16_t entry[programPositions]; // first step of each dial position
+    uint8_t padding[12];
+};
+static_assert(sizeof(ProgramHeader) == 64, "header is 64 bytes");
+
+// FNV-1a over the step records
+inline uint32_t programChecksum(const ProgramStep *_steps, int _count) {
+    const uint8_t *_bytes = (const uint8_t *)_steps;
+    uint32_t _hash = 2166136261u;
+    for (int i = 0; i < _count * (int)sizeof(ProgramStep); i++)
+        _hash = (_hash ^ _bytes[i]) * 16777619u;
+    return _hash;
+}
+
+#endif
@@ -0,0 +1,226 @@
+#include <string.h>
+#include "SimBackend.h"
+
+/*
+ * In-memory GPIO backend with a virtual clock, see SimBackend.h
+*/
+#define simPins 32
+#define simTimers 10 // pigpio has timers 0-9
+#define simNever UINT64_MAX
+
+static uint64_t Sim_Clock = 0; // microseconds
+static uint32_t Sim_Bank = 0; // level of every pin
+static uint32_t Sim_Bank_Writes = 0;
+
+static GpioAlertFunction Sim_Alerts[simPins];
+static unsigned Sim_Watchdog_Timeout[simPins]; // ms, 0 = off
+static uint64_t Sim_Watchdog_Due[simPins];
+
+struct SimTimer {
+    GpioTimerFunction function;
+    uint64_t period; // microseconds
+    uint64_t due;
+};
+static SimTimer Sim_Timers[simTimers];
+
+static GpioPulse Sim_Wave[maxWavePulses];
+static int Sim_Wave_Count = 0; // 0 when no wave is being sent
+static int Sim_Wave_Step = 0;
+static uint64_t Sim_Wave_Due = simNever;
+static GpioPulse Sim_Armed_Wave[maxWavePulses];
+static int Sim_Armed_Count = 0; // 0 when no wave is armed
+
+static int simInitialise(void) {
+    Sim_Clock = 0;
+    Sim_Bank = 0;
+    Sim_Bank_Writes = 0;
+    memset(Sim_Alerts, 0, sizeof(Sim_Alerts));
+    memset(Sim_Watchdog_Timeout, 0, sizeof(Sim_Watchdog_Timeout));
+    for (SimTimer &_simTimer : Sim_Timers)
+        _simTimer = { NULL, 0, simNever };
+    Sim_Wave_Count = 0;
+    Sim_Wave_Due = simNever;
+    Sim_Armed_Count = 0;
+    return 0;
+}
+
+static void simTerminate(void) {
+    simInitialise();
+}
+
+static void simSetOutput(int _pin) {
+}
+
+static void simSetInput(int _pin) {
+}
+
+static void simSetSenseInput(int _pin) {
+}
+
+static void simSetGlitchFilter(int _pin, unsigned _steady) {
+}
+
+static void simSetAlert(int _pin, GpioAlertFunction _function) {
+    Sim_Alerts[_pin] = _function;
+}
+
+static void simSetWatchdog(int _pin, unsigned _timeout) {
+    Sim_Watchdog_Timeout[_pin] = _timeout;
+    Sim_Watchdog_Due[_pin] = _timeout ? Sim_Clock + _timeout * 1000ull : simNever;
+}
+
+static void simSetTimer(int _timer, unsigned _millis, GpioTimerFunction _function) {
+    SimTimer &_simTimer = Sim_Timers[_timer];
+    _simTimer.function = _function;
+    _simTimer.period = _millis * 1000ull;
+    _simTimer.due = _function ? Sim_Clock + _simTimer.period : simNever;
+}
+
+static int simRead(int _pin) {
+    return (Sim_Bank >> _pin) & 1;
+}
+
+static uint32_t simReadBank(void) {
+    return Sim_Bank;
+}
+
+static void simSetBank(uint32_t _bits) {
+    Sim_Bank |= _bits;
+    Sim_Bank_Writes++;
+}
+
+static void simClearBank(uint32_t _bits) {
+    Sim_Bank &= ~_bits;
+    Sim_Bank_Writes++;
+}
+
+static void simWriteBank(uint32_t _clearBits, uint32_t _setBits) {
+    simClearBank(_clearBits);
+    simSetBank(_setBits);
+}
+
+static uint32_t simTick(void) {
+    return (uint32_t)Sim_Clock; // wraps like the real tick
+}
+
+static void simWaveStep(void) {
+    const GpioPulse &_pulse = Sim_Wave[Sim_Wave_Step];
+    Sim_Bank = (Sim_Bank | _pulse.onBits) & ~_pulse.offBits;
+    Sim_Wave_Due = Sim_Clock + _pulse.usDelay;
+    if (++Sim_Wave_Step >= Sim_Wave_Count)
+        Sim_Wave_Step = 0;
+}
+
+static int simSendWave(const GpioPulse *_pulses, int _count) {
+    if (_count <= 0 || _count > maxWavePulses)
+        return -1;
+    memcpy(Sim_Wave, _pulses, _count * sizeof(GpioPulse));
+    Sim_Wave_Count = _count;
+    Sim_Wave_Step = 0;
+    simWaveStep();
+    return 0;
+}
+
+static void simStopWave(void) {
+    Sim_Wave_Count = 0;
+    Sim_Wave_Due = simNever;
+}
+
+static int simArmWave(const GpioPulse *_pulses, int _count) {
+    if (_count <= 0 || _count > maxWavePulses)
+        return -1;
+    memcpy(Sim_Armed_Wave, _pulses, _count * sizeof(GpioPulse));
+    Sim_Armed_Count = _count;
+    return 0;
+}
+
+static void simSendArmedWave(void) {
+    if (Sim_Armed_Count)
+        simSendWave(Sim_Armed_Wave, Sim_Armed_Count);
+}
+
+void simSetLevel(int _pin, int _level) {
+    uint32_t _bit = 1u << _pin;
+    if (((Sim_Bank & _bit) != 0) == (_level != 0))
+        return; // no change, no alert
+
+    Sim_Bank = _level ? (Sim_Bank | _bit) : (Sim_Bank & ~_bit);
+    if (Sim_Watchdog_Timeout[_pin])
+        Sim_Watchdog_Due[_pin] = Sim_Clock + Sim_Watchdog_Timeout[_pin] * 1000ull; // an edge restarts the watchdog
+    if (Sim_Alerts[_pin])
+        Sim_Alerts[_pin](_pin, _level ? 1 : 0, simTick());
+}
+
+/*
+ * Fires events in time order until _micros have passed. Each event is
+ * rescheduled before its callback runs so the callback can cancel or
+ * re-arm it, the same as pigpio.
+*/
+void simAdvance(uint64_t _micros) {
+    uint64_t _end = Sim_Clock + _micros;
+    for (;;) {
+        uint64_t _due = Sim_Wave_Due;
+        int _timer = -1;
+        int _watchdog = -1;
+        for (int i = 0; i < simTimers; i++) {
+            if (Sim_Timers[i].due < _due) {
+                _due = Sim_Timers[i].due;
+                _timer = i;
+            }
+        }
+        for (int i = 0; i < simPins; i++) {
+            if (Sim_Watchdog_Timeout[i] && Sim_Watchdog_Due[i] < _due) {
+                _due = Sim_Watchdog_Due[i];
+                _watchdog = i;
+                _timer = -1;
+            }
+        }
+        if (_due > _end)
+            break;
+
+        Sim_Clock = _due;
+        if (_watchdog >= 0) {
+            Sim_Watchdog_Due[_watchdog] = _due + Sim_Watchdog_Timeout[_watchdog] * 1000ull;
+            if (Sim_Alerts[_watchdog])
+                Sim_Alerts[_watchdog](_watchdog, 2, simTick());
+        } else if (_timer >= 0) {
+            SimTimer &_simTimer = Sim_Timers[_timer];
+            _simTimer.due = _due + _simTimer.period;
+            _simTimer.function();
+        } else {
+            simWaveStep();
+        }
+    }
+    Sim_Clock = _end;
+}
+
+uint64_t simClock(void) {
+    return Sim_Clock;
+}
+
+uint32_t simBankWrites(void) {
+    return Sim_Bank_Writes;
+}
+
+const GpioBackend SimulatedBackend = {
+    "simulated",
+    simInitialise,
+    simTerminate,
+    simSetOutput,
+    simSetInput,
+    simSetSenseInput,
+    simSetGlitchFilter,
+    simSetAlert,
+    simSetWatchdog,
+    simSetTimer,
+    simRead,
+    simReadBank,
+    simSetBank,
+    simClearBank,
+    simWriteBank,
+    simTick,
+    simSendWave,
+    simStopWave,
+    simArmWave,
+    simSendArmedWave,
+};
@@ -0,0 +1,29 @@
+#ifndef SIM_BACKEND_H
+#define SIM_BACKEND_H
+
+#include <stdint.h>
+#include "GpioBackend.h"
+
+/*
+ * SIMULATED BACKEND
+ * 	An in-memory GPIO bank with a virtual clock, so the controller can be
+ * 		run and benchmarked off the Pi. Nothing happens on its own, time
+ * 		only moves when simAdvance() is called and inputs only change when
+ * 		simSetLevel() is called. Timers, watchdogs and waves fire from
+ * 		inside simAdvance() on the calling thread.
+ * 	Glitch filters are accepted but not simulated, drive clean edges.
+*/
+
+// drives an input pin, calls its alert if the level changed
+void simSetLevel(int _pin, int _level);
+
+// moves the virtual clock on, firing every timer, watchdog and wave step due on the way
+void simAdvance(uint64_t _micros);
+
+// virtual time since initialise, microseconds
+uint64_t simClock(void);
+
+// number of bank set/clear calls made since initialise
+uint32_t simBankWrites(void);
+
+#endif
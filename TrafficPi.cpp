@@ -1,101 +1,60 @@
 #include <stdio.h>
-#include <pigpio.h>
-/*
- * PROGRAM OVERVIEW
- * 	Each control input is set up with an Alert function which will call
- * 		gpioSetTimerFunc() with the desired interval the lights will
- * 		change, and will also change the step taken after each iteration.
- * 		The end result is a responsive system that uses a simple method
- * 		to change the current light.
-*/
-
-/*
-    CHANGE SPEED VALUES HERE
-    (time between changes in milliseconds)
-*/
-#define slowSpeed 5000 // 5 seconds
-#define mediumSpeed 2000 // 2 seconds
-#define fastSpeed 1000 // 1 second
-
-/*
-TrafficPi control settings:
-(left -> right)
-
-0) random(party mode?)
-1) downwards roation slow
-2) downwards rotation medium
-3) downwards rotation fast
-4) upwards rotation slow
-5) upwards rotation medium
-6) upwards rotation fast
-7) flashing slow
-8) flashing medium
-9) flashing fast
-*/
-
-/*
- ***************************************
- ******** GPIO port connections ********
- ***************************************
- * 	Connection		 GPIO	Connection
- * 	[3V3]			-	-	[5V]
- * 	redLight		2	-	[5V]
- * 	amberLight		3	-	[GROUND]
- * 	greenLight		4	14
- * 	[GROUND]		-	15
- * 	redBiasOn		17	18
- * 	redBiasOff		27	-	[GROUND]
- * 	amberBiasOn		22	23
- * 	[GROUND]		-	24
- * 	amberBiasOff		10	-	[GROUND]
- * 	greenBiasOn		9	25
- * 	greenBiasOff		11	8
- * 	[GROUND]		-	7
- * 	modeRand		0	1
- * 	modeDownSlow		5	-	[GROUND]
- * 	modeDownMedium		6	12	modeUpFast
- * 	modeDownFast		13	-	[GROUND]
- * 	modeUpSlow		19	16	modeFlashSlow
- * 	modeUpMedium		26	20	modeFlashMedium
- * 	[GROUND]		-	21	modeFlashFast
-*/
-
-#define redLight 2
-#define amberLight 3
-#define greenLight 4
-int Lights[] = { redLight, amberLight, greenLight };
-
-#define redOnBias 17
-#define redOffBias 27
-#define amberOnBias 22
-#define amberOffBias 10
-#define greenOnBias 9
-#define greenOffBias 11
-int OnBias[] = { redOnBias, amberOnBias, greenOnBias };
-int OffBias[] = { redOffBias, amberOffBias, greenOffBias };
-
-
-
-#define modeRand 0
-#define modeDownSlow 5
-#define modeDownMedium 6
-#define modeDownFast 13
-#define modeUpSlow 19
-#define modeUpMedium 26
-#define modeUpFast 12
-#define modeFlashSlow 16
-#define modeFlashMedium 20
-#define modeFlashFast 21
-int Modes{
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <atomic>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "TrafficPi.h"
+#include "EventLog.h"
+#include "SequenceProgram.h"
+#include "PinMap.h"
+
+// the controller, see TrafficPi.h for the program overview and pin connections
+
+const GpioBackend *Gpio = NULL; // set by main() before setup()
+
+// number of elements in an array
+#define countOf(_array) ((int)(sizeof(_array) / sizeof((_array)[0])))
+
+constexpr int Modes[] = {
     modeRand, 
     modeDownSlow, modeDownMedium, modeDownFast,
     modeUpSlow, modeUpMedium, modeUpFast,
     modeFlashSlow, modeFlashMedium, modeFlashFast
-    }
+    };
+constexpr uint32_t MODE_PIN_BITS = pinBits(Modes, countOf(Modes));
+static_assert(pinsUsable(Modes, countOf(Modes), 0), "mode pins must be user GPIOs, each used once");
+
+// head used when no pin map is loaded, checked against the other inputs at compile time, see PIN MAPS in PinMap.h
+typedef BoardWiring<redLight, amberLight, greenLight,
+    redOnBias, redOffBias, amberOnBias, amberOffBias, greenOnBias, greenOffBias,
+    MODE_PIN_BITS | pinBit(preemptPin)> DefaultWiring;
+
+// per pin glitch filter, pins not listed use the default for their group
+// e.g. { modeDownSlow, 10000 } for a worn contact on the slow position
+struct PinDebounce {
+    int pin;
+    unsigned steady; // microseconds
+};
+PinDebounce DebounceOverrides[] = {
+    { -1, 0 }, // end of table, add overrides above this line
+};
 
 /*
 	gpioSetTimerFunc(); //request a regular timed callback
 	gpioSetAlertFunc(); //request a GPIO level change callback
+	(reached through Gpio->setTimer() and Gpio->setAlert(), see GpioBackend.h)
 
 * TIMER
 * 	To set a timer for the first time simply use
@@ -115,14 +74,432 @@ int Modes{
 */
 
 /*
- * These masks reflect the state of the bias switches and 
- * are updates from updateOnBias() and updateOffBias()
+ * LATENCY
+ * 	When started with -l the callbacks record how late things happen into
+ * 		fixed size histograms which are printed when SIGUSR1 is received.
+ * 	switch to lamp: tick of a bias or mode edge to the next light commit
+ * 	tick jitter: how long after its deadline each head's step was taken
+ * 	preempt to lamp: tick of a preemption edge to its lights being written
+ * 	Bucket i counts samples below 2^i microseconds, so percentiles are
+ * 		reported as the upper edge of their bucket.
+*/
+#define histogramBuckets 32
+
+struct LatencyHistogram {
+    const char *name;
+    std::atomic<uint32_t> buckets[histogramBuckets];
+    std::atomic<uint32_t> count;
+    std::atomic<uint32_t> max; // microseconds
+};
+
+bool Measure_Latency = false;
+LatencyHistogram Switch_Latency = { "switch to lamp" };
+LatencyHistogram Tick_Jitter = { "tick jitter" };
+LatencyHistogram Preempt_Latency = { "preempt to lamp" };
+
+// tick of the oldest edge not yet shown on the lights, 0 when there is none
+std::atomic<uint32_t> Edge_Tick(0);
+
+void recordLatency(LatencyHistogram &_histogram, uint32_t _micros) {
+    int _bucket = _micros ? 32 - __builtin_clz(_micros) : 0;
+    if (_bucket >= histogramBuckets)
+        _bucket = histogramBuckets - 1;
+    _histogram.buckets[_bucket].fetch_add(1, std::memory_order_relaxed);
+    _histogram.count.fetch_add(1, std::memory_order_relaxed);
+
+    uint32_t _max = _histogram.max.load(std::memory_order_relaxed);
+    while (_micros > _max && !_histogram.max.compare_exchange_weak(_max, _micros, std::memory_order_relaxed)) {
+    }
+}
+
+// called from the input callbacks with the tick pigpio gave them
+void recordEdge(uint32_t _tick) {
+    if (!Measure_Latency)
+        return;
+    uint32_t _none = 0;
+    Edge_Tick.compare_exchange_strong(_none, _tick | 1, std::memory_order_relaxed); // keep the oldest, 0 is none
+}
+
+// upper edge in microseconds of the bucket the _fraction percentile falls in
+uint32_t histogramPercentile(const LatencyHistogram &_histogram, uint32_t _count, double _fraction) {
+    uint32_t _target = (uint32_t)(_count * _fraction);
+    uint32_t _seen = 0;
+    for (int i = 0; i < histogramBuckets; i++) {
+        _seen += _histogram.buckets[i].load(std::memory_order_relaxed);
+        if (_seen > _target)
+            return i ? (1u << i) - 1 : 0;
+    }
+    return _histogram.max.load(std::memory_order_relaxed);
+}
+
+void printLatency(const LatencyHistogram &_histogram) {
+    uint32_t _count = _histogram.count.load(std::memory_order_relaxed);
+    if (_count == 0) {
+        printf("%s: no samples\n", _histogram.name);
+        return;
+    }
+    printf("%s: %u samples, p50 < %u us, p99 < %u us, max %u us\n", _histogram.name, _count,
+        histogramPercentile(_histogram, _count, 0.50),
+        histogramPercentile(_histogram, _count, 0.99),
+        _histogram.max.load(std::memory_order_relaxed));
+}
+
+void printLatencyReport(void) {
+    if (!Measure_Latency) {
+        printf("latency is only measured when started with -l\n");
+        return;
+    }
+    printLatency(Switch_Latency);
+    printLatency(Tick_Jitter);
+    printLatency(Preempt_Latency);
+}
+
+/*
+ * METRICS
+ * 	Counters for formatMetrics(), kept per thread so counting is a plain
+ * 		load and store on a cache line no other thread writes. Each
+ * 		thread takes a slot the first time it counts anything, and the
+ * 		slots are only summed when the metrics are scraped.
+ * 	pigpio makes a new thread each time low power sets a timer again and
+ * 		for each pin with -i isr, so a slot is handed back
+ * 		when its thread exits, keeping its counts for the next owner.
+ * 	The last slot is shared by any threads past the rest and counts with
+ * 		fetch_add.
+*/
+#define maxMetricSlots 16
+#define sharedMetricSlot (maxMetricSlots - 1)
+#define metricRotations 5 // the direction functions, then sequence programs
+
+struct alignas(64) MetricSlot {
+    std::atomic<uint64_t> steps[metricRotations]; // head steps taken by each rotation
+    std::atomic<uint64_t> passes; // scheduler passes
+    std::atomic<uint64_t> overruns; // steps taken more than one pass late
+    std::atomic<uint64_t> modeChanges;
+    std::atomic<uint64_t> biasEdges;
+    std::atomic<uint64_t> preemptions;
+};
+
+MetricSlot Metric_Slots[maxMetricSlots];
+std::atomic<bool> Metric_Slot_Taken[sharedMetricSlot];
+
+// a thread's slot, handed back when the thread exits
+struct MetricOwner {
+    int slot = -1;
+    ~MetricOwner() {
+        if (slot >= 0 && slot < sharedMetricSlot)
+            Metric_Slot_Taken[slot].store(false, std::memory_order_release);
+    }
+};
+thread_local MetricOwner Thread_Metrics;
+
+inline MetricSlot &threadMetrics(void) {
+    if (Thread_Metrics.slot < 0) {
+        Thread_Metrics.slot = sharedMetricSlot;
+        for (int i = 0; i < sharedMetricSlot; i++) {
+            bool _free = false;
+            if (Metric_Slot_Taken[i].compare_exchange_strong(_free, true, std::memory_order_acquire)) {
+                Thread_Metrics.slot = i;
+                break;
+            }
+        }
+    }
+    return Metric_Slots[Thread_Metrics.slot];
+}
+
+// only the thread owning a slot writes it, so no locked add is needed outside the shared one
+inline void countMetric(std::atomic<uint64_t> &_counter, uint64_t _count = 1) {
+    if ((const void *)&_counter >= (const void *)&Metric_Slots[sharedMetricSlot])
+        _counter.fetch_add(_count, std::memory_order_relaxed);
+    else
+        _counter.store(_counter.load(std::memory_order_relaxed) + _count, std::memory_order_relaxed);
+}
+
+uint64_t sumMetric(std::atomic<uint64_t> MetricSlot::*_counter) {
+    uint64_t _sum = 0;
+    for (const MetricSlot &_slot : Metric_Slots)
+        _sum += (_slot.*_counter).load(std::memory_order_relaxed);
+    return _sum;
+}
+
+/*
+ * CONTROLLER STATE
+ * 	Everything the alert callbacks hand over to the timer callback for a
+ * 		head is packed into one word and published atomically, so the
+ * 		timer always reads a consistent snapshot without taking a lock.
+ * 	bits 0-2	BIAS_OFF_MASK (updated from updateOffBias())
+ * 	bits 3-5	BIAS_ON_MASK (updated from updateOnBias())
+ * 	bits 8-11	profile, position of the mode dial whose TimingProfile runs
+ * 	The ON and OFF masks together (bits 0-5) are the BIAS_INDEX row used
+ * 		in OUTPUT_LUT.
+*/
+#define STATE_BIAS_SHIFT 0
+#define STATE_BIAS_BITS (0x3Fu << STATE_BIAS_SHIFT)
+#define STATE_PROFILE_SHIFT 8
+#define STATE_PROFILE_BITS (0xFu << STATE_PROFILE_SHIFT)
+
+constexpr uint32_t makeState(int _onMask, int _offMask, int _profile) {
+    return ((uint32_t)((_onMask << 3) | _offMask) << STATE_BIAS_SHIFT)
+        | ((uint32_t)_profile << STATE_PROFILE_SHIFT);
+}
+
+inline int stateBiasIndex(uint32_t _state) { return (_state & STATE_BIAS_BITS) >> STATE_BIAS_SHIFT; }
+inline int stateProfile(uint32_t _state) { return (_state & STATE_PROFILE_BITS) >> STATE_PROFILE_SHIFT; }
+
+// no bias, rotating down at medium speed (dial position 2)
+#define initialState makeState(0b000, 0b111, 2)
+
+/*
+ * TIMING PROFILES
+ * 	Each position of the mode dial runs a profile, the rotation to use and
+ * 		how long each step of its sequence lasts. The built in profiles
+ * 		come from the speeds in TrafficPi.h, a profile file loaded with
+ * 		-t <file> replaces any of them and is read again on SIGHUP.
+ * 	One profile per line, positions as in the control settings list:
+ * 		position rotation milliseconds [milliseconds ...]
+ * 		rotation is down, up, flash or random, the durations are for each
+ * 		step in turn and repeat if there are fewer than the steps, e.g.
+ * 		1 down 30000 3000 25000 	red 30s, amber 3s, green 25s
+ * 		for random the duration is the shortest step, a step lasts 1 to
+ * 		PARTY_MAX_STEPS of them. Anything after a # is ignored.
+ * 	Steps are at most maxStepMillis, the shortest random step at most
+ * 		maxRandomStepMillis, see SequenceProgram.h.
+ * 	Durations are turned into microseconds when the file is read so the
+ * 		timer callback only indexes a table.
+*/
+#define maxSequenceSteps 8
+
+struct TimingProfile {
+    int rotation; // position in the direction function array
+    int stepCount; // durations given, 1 to maxSequenceSteps
+    uint32_t stepMicros[maxSequenceSteps];
+};
+
+// pin of the mode that is running, -1 before the first mode is applied
+// only used from the alert callbacks
+int Current_Mode = -1;
+
+/*
+ * Lookup table from bias switch to bit in the 3 bit masks (red << amber << green).
+ * Each head has one entry per light, built from its pin map.
+*/
+struct BiasBit {
+    uint32_t onPin; // bank bit of the ON bias switch, 0 if there is none
+    uint32_t offPin; // bank bit of the OFF bias switch, 0 if there is none
+    int maskBit; // bit in the BIAS_ON_MASK / BIAS_OFF_MASK of the state
+};
+
+/*
+ * LIGHT HEADS
+ * 	A head is one set of red/amber/green lights with its own bias switches
+ * 		and its own CONTROLLER STATE word. Every head follows the one mode
+ * 		dial, they are all stepped from the same tick and the lights of
+ * 		every head are written to the bank together in one clear and set.
+ * 	Pin maps are loaded with -p <file>, one head per line:
+ * 		red amber green [redOn redOff amberOn amberOff greenOn greenOff] [@offset] [!redSense amberSense greenSense]
+ * 		offset is how many milliseconds the head's steps come after the
+ * 		first head's, the sense pins read high while each lamp is drawing
+ * 		current (-1 for a lamp without one, see LAMP FEEDBACK), anything
+ * 		after a # is ignored. Without -p there is one head on the pins in
+ * 		TrafficPi.h, checked when it is built (see PIN MAPS in PinMap.h).
+*/
+#define maxHeads 8
+
+struct LightHead {
+    int lights[3]; // red, amber, green
+    int onBias[3]; // noPin when the head has no bias switches
+    int offBias[3];
+    LightBits lightBits; // bank bits lit by each 3 bit request (red << amber << green)
+    BiasBit biasBits[3];
+    std::atomic<uint32_t> state;
+    uint32_t offset; // microseconds this head runs behind the first, for green waves
+    int sense[3]; // lamp current sense inputs, noPin when a lamp has none
+    uint32_t senseBits[3]; // bank bit of each sense input, 0 if there is none
+    int darkSamples[3]; // samples in a row a lit lamp has read dark, only used from the feedback timer
+    // only used from the timer callback
+    const TimingProfile *profile; // profile of the step being taken
+    uint32_t programGeneration; // load of the program being run, 0 for none, see PROGRAMS
+    int programPosition; // dial position it was entered from
+    int programStep; // step shown next
+    int sequenceStage; // index into the running sequence
+    uint32_t shownBits; // bank bits of the request being shown
+    uint32_t stepMicros; // how long the step being shown lasts
+    uint32_t due; // gpioTick() of the next step, see SCHEDULER
+};
+
+LightHead Heads[maxHeads];
+int Head_Count = 0;
+uint32_t All_Light_Bits = 0; // bank bits of the lights of every head
+uint32_t Head_Pins = 0; // bank bits of every pin used by a head
+std::atomic<uint32_t> Shown_Lights(0); // bank bits of the lights last written, for other threads
+uint32_t Red_Light_Bits = 0; // bank bits of the red light of every head
+
+/*
+ * Adds a head whose pins are already known to be usable, with the light
+ * table and the bank bits it takes up worked out from them. Returns -1 if
+ * there is no room for it.
+*/
+int addCheckedHead(const int *_pins, int _pinCount, unsigned _offset, const int *_sense,
+    const LightBits &_lightBits, uint32_t _pinsUsed) {
+    if (Head_Count >= maxHeads)
+        return -1;
+
+    LightHead &_head = Heads[Head_Count];
+    for (int i = 0; i < 3; i++) {
+        _head.lights[i] = _pins[i];
+        _head.onBias[i] = _pinCount == 9 ? _pins[3 + i * 2] : noPin;
+        _head.offBias[i] = _pinCount == 9 ? _pins[4 + i * 2] : noPin;
+        _head.biasBits[i].onPin = pinBit(_head.onBias[i]);
+        _head.biasBits[i].offPin = pinBit(_head.offBias[i]);
+        _head.biasBits[i].maskBit = LIGHT_MASK_BITS[i];
+        _head.sense[i] = _sense ? _sense[i] : noPin;
+        _head.senseBits[i] = pinBit(_head.sense[i]);
+        _head.darkSamples[i] = 0;
+    }
+    _head.lightBits = _lightBits;
+    _head.state.store(initialState, std::memory_order_relaxed);
+    _head.offset = _offset * 1000; // ms to us
+    _head.profile = NULL;
+    _head.programGeneration = 0;
+    _head.programPosition = -1;
+    _head.programStep = 0;
+    _head.sequenceStage = -1; //first step taken shows the start of the sequence
+    _head.shownBits = 0;
+    _head.stepMicros = 0;
+    _head.due = 0;
+
+    All_Light_Bits |= _head.lightBits[0b111];
+    Red_Light_Bits |= _head.lightBits[0b100];
+    Head_Pins |= _pinsUsed;
+    Head_Count++;
+    return 0;
+}
+
+/*
+ * Adds a head from its pins (red, amber, green then optionally the six bias
+ * switches in the order of the pin map file) and optionally the three lamp
+ * sense inputs. Returns -1 if it cannot be used.
+*/
+int addHead(const int *_pins, int _pinCount, unsigned _offset, const int *_sense) {
+    if (_pinCount != 3 && _pinCount != 9)
+        return -1;
+
+    int _allPins[12];
+    int _allCount = 0;
+    for (int i = 0; i < _pinCount; i++) {
+        if (_pins[i] == noPin)
+            return -1; // lights and bias switches are all or nothing
+        _allPins[_allCount++] = _pins[i];
+    }
+    for (int i = 0; _sense && i < 3; i++) {
+        if (_sense[i] != noPin)
+            _allPins[_allCount++] = _sense[i];
+    }
+    if (!pinsUsable(_allPins, _allCount, Head_Pins | MODE_PIN_BITS | pinBit(preemptPin)))
+        return -1; // not a user GPIO or already in use
+    return addCheckedHead(_pins, _pinCount, _offset, _sense, lightBitsFor(_pins), pinBits(_allPins, _allCount));
+}
+
+int loadHeads(const char *_path) {
+    FILE *_file = fopen(_path, "r");
+    if (!_file) {
+        printf("could not open pin map %s\n", _path);
+        return -1;
+    }
+
+    char _line[256];
+    int _lineNumber = 0;
+    while (fgets(_line, sizeof(_line), _file)) {
+        _lineNumber++;
+        int _pins[10];
+        int _pinCount = 0;
+        char *_next = _line;
+        for (;;) {
+            char *_end;
+            long _pin = strtol(_next, &_end, 10);
+            if (_end == _next)
+                break; // not a number, end of the pins on this line
+            if (_pinCount < 10)
+                _pins[_pinCount] = (int)_pin;
+            _pinCount++;
+            _next = _end;
+        }
+        while (*_next == ' ' || *_next == '\t')
+            _next++;
+        long _offset = 0;
+        if (*_next == '@') {
+            char *_end;
+            _offset = strtol(_next + 1, &_end, 10);
+            if (_end == _next + 1 || _offset < 0)
+                _pinCount = -1;
+            _next = _end;
+            while (*_next == ' ' || *_next == '\t')
+                _next++;
+        }
+        int _sense[3];
+        bool _hasSense = *_next == '!';
+        if (_hasSense) {
+            _next++;
+            for (int i = 0; i < 3; i++) {
+                char *_end;
+                _sense[i] = (int)strtol(_next, &_end, 10);
+                if (_end == _next || _sense[i] < noPin)
+                    _pinCount = -1;
+                _next = _end;
+            }
+            while (*_next == ' ' || *_next == '\t')
+                _next++;
+        }
+        if (*_next != '\0' && *_next != '\n' && *_next != '\r' && *_next != '#')
+            _pinCount = -1; // rubbish on the line
+
+        if (_pinCount == 0)
+            continue; // blank or comment line
+        if (_pinCount < 0 || addHead(_pins, _pinCount, (unsigned)_offset, _hasSense ? _sense : NULL) < 0) {
+            printf("%s:%d: bad head, expected 3 or 9 unused pins, an optional @offset and !sense pins\n", _path, _lineNumber);
+            fclose(_file);
+            return -1;
+        }
+    }
+    fclose(_file);
+    return 0;
+}
+
+/*
+ * Replaces the _fields bits of a head's state with _value and publishes it.
+ * Only the alert callbacks write so the loop normally runs once.
+*/
+void publishState(LightHead &_head, uint32_t _fields, uint32_t _value) {
+    uint32_t _state = _head.state.load(std::memory_order_relaxed);
+    while (!_head.state.compare_exchange_weak(_state, (_state & ~_fields) | _value,
+        std::memory_order_release, std::memory_order_relaxed)) {
+    }
+}
+
+/*
+ * Rebuilds the masks of every head from one read of the bank, so the ON
+ * and OFF masks always come from the same instant.
+ * for the ON bias, Mask should match request (ON = 1)
+ * for the OFF bias, Mask should be opposite of request (ON = 0)
 */
-int BIAS_ON_MASK = 0b000; 
-int BIAS_OFF_MASK = 0b111;
+void applyBias(uint32_t _bank) {
+    for (int h = 0; h < Head_Count; h++) {
+        int _onMask = 0b000;
+        int _offMask = 0b111;
+        for (const BiasBit &_bias : Heads[h].biasBits) {
+            if (_bank & _bias.onPin)
+                _onMask |= _bias.maskBit;
+            if (_bank & _bias.offPin)
+                _offMask &= ~_bias.maskBit;
+        }
+        publishState(Heads[h], STATE_BIAS_BITS, makeState(_onMask, _offMask, 0));
+    }
+}
+
+void sampleBias(void) {
+    applyBias(Gpio->readBank());
+}
 
-// Keeps track of which stage the light cycle is at
-int Sequence_Stage = 0b100; //start on red
+void refreshWave(void); // rebuilds the light wave, see WAVE PLAYBACK
 
 /*
  * Function called when an ON bias switch is changed
@@ -133,8 +510,11 @@ void updateOnBias(int _pin, int _level, uint32_t _tick) {
     {
     case 0:
     case 1: // bias switch turned on or off
-        // for the ON bias, Mask should match request (ON = 1)
-        BIAS_ON_MASK = gpioRead(redOnBias) << gpioRead(amberOnBias) << gpioRead(greenOnBias);
+        recordEdge(_tick);
+        countMetric(threadMetrics().biasEdges);
+        logEvent(eventOnBias, _pin, _level, 0, Shown_Lights.load(std::memory_order_relaxed), _tick);
+        sampleBias();
+        refreshWave();
         break;
 
     default:
@@ -153,8 +533,11 @@ void updateOffBias(int _pin, int _level, uint32_t _tick) {
     {
     case 0:
     case 1: // bias switch turned on or off
-        // for the OFF bias, Mask should be opposite of request (ON = 0)
-        BIAS_OFF_MASK = ~gpioRead(redOffBias) << ~gpioRead(amberOffBias) << ~gpioRead(greenOffBias);
+        recordEdge(_tick);
+        countMetric(threadMetrics().biasEdges);
+        logEvent(eventOffBias, _pin, _level, 0, Shown_Lights.load(std::memory_order_relaxed), _tick);
+        sampleBias();
+        refreshWave();
         break;
 
     default:
@@ -164,205 +547,1382 @@ void updateOffBias(int _pin, int _level, uint32_t _tick) {
 }
 
 /*
- * use last 3 bits of request to turn lights on/off
+ * WATCHDOG
+ * 	If the scheduler stops ticking the lights would freeze on whatever was
+ * 		last written. Each tick bumps Heartbeat, which is all the normal
+ * 		path pays, and a monitor on its own timer (timer 2) checks it
+ * 		every watchdogPeriod ms.
+ * 	When it has not moved for watchdogTimeout ms the monitor sends the safe
+ * 		state, a DMA wave armed at setup so nothing has to be built, and
+ * 		latches. The scheduler writes no more lights (see commitLights())
+ * 		and the state holds until the program is restarted.
+ * 	With -g the monitor also feeds a hardware watchdog such as
+ * 		/dev/watchdog while the heartbeat moves. If the whole process
+ * 		stops, or once the safe state has been sent, it is no longer fed
+ * 		and the Pi is reset when it runs out.
+ * 	With -w the DMA does the timing and there is no heartbeat to watch.
+*/
+std::atomic<uint32_t> Heartbeat(0); // scheduler ticks, only sequenceTick() writes it
+std::atomic<bool> Watchdog_Tripped(false); // the safe state has been sent
+uint32_t Last_Heartbeat = 0; // monitor only
+int Missed_Checks = 0; // monitor only
+int Hardware_Watchdog = -1; // -g device, -1 when there is none
+
+int openHardwareWatchdog(const char *_path) {
+    Hardware_Watchdog = open(_path, O_WRONLY | O_CLOEXEC);
+    if (Hardware_Watchdog < 0) {
+        printf("could not open watchdog %s\n", _path);
+        return -1;
+    }
+    return 0;
+}
+
+void closeHardwareWatchdog(void) {
+    if (Hardware_Watchdog < 0)
+        return;
+    if (write(Hardware_Watchdog, "V", 1) != 1) // magic close, disarms it on a clean shutdown
+        printf("watchdog would not disarm, the Pi will reset\n");
+    close(Hardware_Watchdog);
+    Hardware_Watchdog = -1;
+}
+
+void checkHeartbeat(void) {
+    if (Watchdog_Tripped.load(std::memory_order_relaxed))
+        return; // latched, the hardware watchdog is left to run out
+    uint32_t _beat = Heartbeat.load(std::memory_order_relaxed);
+    if (_beat != Last_Heartbeat) {
+        Last_Heartbeat = _beat;
+        Missed_Checks = 0;
+        if (Hardware_Watchdog >= 0 && write(Hardware_Watchdog, "k", 1) != 1)
+            printf("could not feed the watchdog\n");
+        return;
+    }
+    if (++Missed_Checks * watchdogPeriod < watchdogTimeout)
+        return;
+
+    Watchdog_Tripped.store(true, std::memory_order_relaxed);
+    Gpio->sendArmedWave();
+    logEvent(eventWatchdog, 0, 0, Missed_Checks * watchdogPeriod, Shown_Lights.load(std::memory_order_relaxed), Gpio->tick());
+    printf("scheduler has not ticked for %d ms, lights forced to the safe state\n", Missed_Checks * watchdogPeriod);
+}
+
+// arms the safe state wave and starts the monitor, after the scheduler is running
+void startWatchdog(void) {
+#if watchdogSafeFlash
+    GpioPulse _pulses[] = {
+        { All_Light_Bits, 0, faultFlashSpeed * 1000 },
+        { 0, All_Light_Bits, faultFlashSpeed * 1000 },
+    };
+#else
+    GpioPulse _pulses[] = {
+        { Red_Light_Bits, All_Light_Bits & ~Red_Light_Bits, 1000000 },
+    };
+#endif
+    int _result = Gpio->armWave(_pulses, countOf(_pulses));
+    if (_result < 0) {
+        printf("could not arm the safe state wave (%d), the scheduler is not watched\n", _result);
+        return;
+    }
+    Last_Heartbeat = Heartbeat.load(std::memory_order_relaxed);
+    Missed_Checks = 0;
+    Gpio->setTimer(2, watchdogPeriod, checkHeartbeat);
+}
+
+/*
+ * use last 3 bits of request to turn a head's lights on/off
  * red << amber << green
+ * Requests are kept for every head, then commitLights() changes all of them
+ * with one clear and one set of the GPIO bank.
+ * Lights are cleared first so the only in-between state is a light being
+ * briefly off, never two extra lights on.
+*/
+int64_t Last_Bits = -1; // bank bits last written to the lights, -1 before the first write
+
+void updateLights(LightHead &_head, uint8_t _outputRequest)
+{
+    uint32_t _bits = _head.lightBits[_outputRequest & 0b111]; // only get last 3 bits
+    if (_bits != _head.shownBits)
+        logEvent(eventLamp, (int)(&_head - Heads), 0, 0, _bits, Gpio->tick());
+    _head.shownBits = _bits;
+}
+
+/*
+ * Light writes from the scheduler and from the preemption input are taken
+ * under Lights_Lock so neither can land on top of the other. It is only
+ * taken when the lights change, a step or a preemption edge.
 */
-void updateLights(uint8_t _outputRequest)
+pthread_mutex_t Lights_Lock = PTHREAD_MUTEX_INITIALIZER;
+bool Preempt_Active = false; // under Lights_Lock, see PREEMPTION
+
+void commitLights(void)
 {
-    _outputRequest = _outputRequest & 0b111; // only get last 3 bits
-    gpioWrite(redLight, (_outputRequest & 0b100) >> 2); //mask for red then move bit
-    gpioWrite(amberLight, (_outputRequest & 0b010) >> 1); //mask for amber then moe bit
-    gpioWrite(greenLight, (_outputRequest & 0b001)); //mask for green
+    uint32_t _setBits = 0;
+    for (int h = 0; h < Head_Count; h++)
+        _setBits |= Heads[h].shownBits;
+    if (_setBits == Last_Bits || Watchdog_Tripped.load(std::memory_order_relaxed))
+        return; // lights already show this or are held in the safe state, nothing to write
+
+    pthread_mutex_lock(&Lights_Lock);
+    if (!Preempt_Active) { // preemption holds the lights, the sequence carries on underneath
+        Gpio->writeBank(All_Light_Bits & ~_setBits, _setBits); //lights that should be off, then those that should be on
+        Shown_Lights.store(_setBits, std::memory_order_relaxed);
+    }
+    Last_Bits = _setBits;
+    pthread_mutex_unlock(&Lights_Lock);
+
+    if (Measure_Latency) {
+        uint32_t _edge = Edge_Tick.exchange(0, std::memory_order_relaxed);
+        if (_edge)
+            recordLatency(Switch_Latency, Gpio->tick() - _edge);
+    }
+}
+
+/*
+ * PREEMPTION
+ * 	Pulling preemptPin low (an emergency vehicle detector closing to
+ * 		ground) shows green on preemptHead and red on every other head
+ * 		straight from the alert callback, without waiting for a scheduler
+ * 		pass. A wire that comes off reads high and does not preempt.
+ * 	Bias switches are ignored while preempted. The scheduler keeps stepping
+ * 		every head underneath with none of it written, so on release the
+ * 		lights go straight back to where the sequence is now and every
+ * 		head keeps its phase.
+ * 	Input to lamp latency is pigpio's alert delivery after the glitch filter
+ * 		(preemptGlitchTime) plus one bank write, recorded with -l.
+ * 	With -w the wave is stopped while preempted, bias and dial edges do not
+ * 		send a new one until the release.
+ * 	A tripped watchdog holds the safe state over a preemption.
+*/
+uint32_t Preempt_Bits = 0; // lights shown while preempted, worked out in setup()
+
+// true if _pin is on the mode dial
+constexpr bool isModePin(int _pin) {
+    for (int _mode : Modes) {
+        if (_mode == _pin)
+            return true;
+    }
+    return false;
+}
+static_assert(!isModePin(preemptPin), "the preemption input cannot be a mode pin");
+
+void updatePreempt(int _pin, int _level, uint32_t _tick) {
+    if (_level == 2 || Watchdog_Tripped.load(std::memory_order_relaxed))
+        return;
+    bool _active = _level == 0;
+
+    pthread_mutex_lock(&Lights_Lock);
+    if (_active == Preempt_Active) {
+        pthread_mutex_unlock(&Lights_Lock);
+        return;
+    }
+    Preempt_Active = _active;
+    if (Wave_Playback && _active)
+        Gpio->stopWave();
+    // on release the lights the scheduler last committed, all off if it has not committed yet (a head @offset)
+    uint32_t _bits = _active ? Preempt_Bits : Last_Bits < 0 ? 0 : (uint32_t)Last_Bits & All_Light_Bits;
+    if (_active || !Wave_Playback) {
+        Gpio->writeBank(All_Light_Bits & ~_bits, _bits);
+        Shown_Lights.store(_bits, std::memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&Lights_Lock);
+
+    if (_active)
+        countMetric(threadMetrics().preemptions);
+    if (Measure_Latency && _active)
+        recordLatency(Preempt_Latency, Gpio->tick() - _tick);
+    logEvent(eventPreempt, _pin, _level, preemptHead, _bits, _tick);
+    if (Wave_Playback && !_active)
+        refreshWave(); // the wave takes the lights back
+}
+
+/*
+ * SEQUENCES
+ * 	Each sequence is a table of 3 bit light patterns (red << amber << green)
+ * 		that is walked one step per timer tick. To add a pattern add a
+ * 		steps table and a Sequence for it, no new rotation code is needed.
+*/
+struct Sequence {
+    const uint8_t *steps;
+    int length;
+};
+
+constexpr uint8_t DOWN_STEPS[] = { 0b100, 0b010, 0b001 }; // red, amber, green
+constexpr uint8_t UP_STEPS[] = { 0b001, 0b010, 0b100 }; // green, amber, red
+constexpr uint8_t FLASH_STEPS[] = { 0b111, 0b000 }; // all on, all off
+
+constexpr Sequence SEQUENCE_DOWN = { DOWN_STEPS, sizeof(DOWN_STEPS) };
+constexpr Sequence SEQUENCE_UP = { UP_STEPS, sizeof(UP_STEPS) };
+constexpr Sequence SEQUENCE_FLASH = { FLASH_STEPS, sizeof(FLASH_STEPS) };
+
+/*
+ * Output for every step under every bias setting, indexed [BIAS_INDEX][step].
+ * Each entry is (step | BIAS_ON_MASK) & BIAS_OFF_MASK worked out at compile time.
+ * BIAS_INDEX is (BIAS_ON_MASK << 3) | BIAS_OFF_MASK, see stateBiasIndex().
+*/
+struct OutputTable {
+    uint8_t output[64][8];
+};
+
+constexpr OutputTable buildOutputTable() {
+    OutputTable _table = {};
+    for (int _bias = 0; _bias < 64; _bias++) {
+        for (int _step = 0; _step < 8; _step++)
+            _table.output[_bias][_step] = (_step | (_bias >> 3)) & (_bias & 0b111);
+    }
+    return _table;
 }
 
-// define a type (functions without inputs)
-typedef void (*DirectionFunction) (void);
+constexpr OutputTable OUTPUT_LUT = buildOutputTable();
 
+/*
+ * Moves a head's running sequence on one step and shows it with bias applied.
+ * The stage is kept across sequences so switching carries on from the same index.
+*/
+void stepSequence(LightHead &_head, const Sequence &_sequence, int _biasIndex) {
+    if (++_head.sequenceStage >= _sequence.length) //take a step
+        _head.sequenceStage = 0;
+    _head.stepMicros = _head.profile->stepMicros[_head.sequenceStage % _head.profile->stepCount];
+    updateLights(_head, OUTPUT_LUT.output[_biasIndex][_sequence.steps[_head.sequenceStage]]); //send to lights
+}
+
+/*
+ * Each direction function is called with the head's profile set to the one
+ * running, it sets stepMicros to how long the step it shows lasts.
+*/
 // position of RotateDown() in the dirction funtion array
 #define rotateDown 0
 // RotateDown() rotates the lights downwards, turning one on at a time before bias
-// Sequence_Stage is a global variable that keeps trck of what the last position was so that other rotate functions can use it
-void RotateDown(void) {
-    Sequence_Stage = rightRotate(Sequence_Step); //take a step
-    int output = Sequence_Step; //use copy of current step
-    output = output | BIAS_ON_MASK; //apply ON bias(s)
-    output = output & BIAS_OFF_MASK;//apply OFF bias(s)
-    updateLights(output); //send to lights
+void RotateDown(LightHead &_head, int _biasIndex) {
+    stepSequence(_head, SEQUENCE_DOWN, _biasIndex);
 }
 
 // position of RotateUp() in the dirction funtion array
 #define rotateUp 1
-// RotateUp() rotates the lights downwards, turning one on at a time before bias
-// Sequence_Stage is a global variable that keeps trck of what the last position was so that other rotate functions can use it
-void RotateUp(void) {
-    Sequence_Stage = leftRotate(Sequence_Step); //take a step
-    int output = Sequence_Step; //use copy of current step
-    output = output | BIAS_ON_MASK; //apply ON bias(s)
-    output = output & BIAS_OFF_MASK;//apply OFF bias(s)
-    updateLights(output); //send to lights
+// RotateUp() rotates the lights upwards, turning one on at a time before bias
+void RotateUp(LightHead &_head, int _biasIndex) {
+    stepSequence(_head, SEQUENCE_UP, _biasIndex);
 }
 
 // position of RotateNone() in the dirction funtion array
 #define rotateNone 2
-// RotateNone() is flashing all lights on then off, so need to keep track of what it was last
-void RotateNone(void) {
-    static int flash_step = 0b111; 
-    flash_step = ~flash_step; //take step
-    int output = flash_step; // take copy
-    output = output | BIAS_ON_MASK; //apply ON bias
-    output = output & BIAS_OFF_MASK; //apply OFF bias
-    updateLights(output); //update lights
+// RotateNone() is flashing all lights on then off
+void RotateNone(LightHead &_head, int _biasIndex) {
+    stepSequence(_head, SEQUENCE_FLASH, _biasIndex);
 }
 
 /*
- * Called when the mode dial has changed. resets timer to new condition when called
+ * Party mode, each step shows a random pattern for a random number of ticks.
+ * xorshift32 keeps this to a few instructions with no rand() or locks,
+ * the state is reseeded by the timer callback each time the mode is entered.
 */
-void updateTimerMode(int _pin, int _level, uint32_t _tick) 
-{
-    static int _speed = mediumSpeed; // controlls time between changes
-    static int _rotation = rotateDown; // controlls what function is called at interval
-    // create array of functions the options can choose from
-    DirectionFunction _directionFunction[] = { RotateDown, RotateUp, RotateNone };
+uint32_t Party_State = 2463534242u; // any value except 0, used from the timer callback or refreshWave() with -w
 
-    gpioSetTimerFunc(0, 10, NULL); //Stop current timer
+uint32_t partyRandom(void) {
+    uint32_t _x = Party_State;
+    _x ^= _x << 13;
+    _x ^= _x >> 17;
+    _x ^= _x << 5;
+    Party_State = _x;
+    return _x;
+}
 
-    // Only looking for _level == 1 since that means a new mode has been selected
-    if (_level != 1)
+// random steps last a whole number of the profile's step, by default fast steps up to one slow step
+constexpr int PARTY_MAX_STEPS = slowSpeed / fastSpeed;
+static_assert(PARTY_MAX_STEPS <= maxRandomSteps, "random steps must stay inside maxStepMillis");
+
+// position of RotateRandom() in the dirction funtion array
+#define rotateRandom 3
+void RotateRandom(LightHead &_head, int _biasIndex) {
+    uint32_t _random = partyRandom();
+    _head.stepMicros = (1 + (_random >> 3) % PARTY_MAX_STEPS) * _head.profile->stepMicros[0]; // how long this pattern stays
+    updateLights(_head, OUTPUT_LUT.output[_biasIndex][_random & 0b111]); //low 3 bits are the pattern
+}
+
+// array of functions the options can choose from
+DirectionFunction DirectionFunctions[] = { RotateDown, RotateUp, RotateNone, RotateRandom };
+
+// sequence each direction function walks, in the same order as the direction function array
+// RotateRandom() has no fixed sequence, its wave is generated in refreshWave()
+const Sequence *RotationSequences[] = { &SEQUENCE_DOWN, &SEQUENCE_UP, &SEQUENCE_FLASH, NULL };
+
+// names of the rotations in a profile file, in the same order as the direction function array
+const char *RotationNames[] = { "down", "up", "flash", "random" };
+
+// built in profiles, one per position of the mode dial in Modes[] order, see TIMING PROFILES
+const TimingProfile DEFAULT_PROFILES[] = {
+    { rotateRandom, 1, { fastSpeed * 1000 } },
+    { rotateDown, 1, { slowSpeed * 1000 } },
+    { rotateDown, 1, { mediumSpeed * 1000 } },
+    { rotateDown, 1, { fastSpeed * 1000 } },
+    { rotateUp, 1, { slowSpeed * 1000 } },
+    { rotateUp, 1, { mediumSpeed * 1000 } },
+    { rotateUp, 1, { fastSpeed * 1000 } },
+    { rotateNone, 1, { slowSpeed * 1000 } },
+    { rotateNone, 1, { mediumSpeed * 1000 } },
+    { rotateNone, 1, { fastSpeed * 1000 } },
+};
+#define profileCount countOf(DEFAULT_PROFILES)
+static_assert(profileCount == countOf(Modes), "one profile per mode pin");
+
+// safe flashing every head is held on once a red lamp has failed, see LAMP FEEDBACK
+const TimingProfile FAULT_PROFILE = { rotateNone, 1, { faultFlashSpeed * 1000 } };
+
+/*
+ * Profiles in use. A reload fills whichever table is not active and then
+ * swaps the pointer, so the timer callback never sees a half written one.
+ * Reloads must be further apart than one timer callback, a person sending
+ * SIGHUP always is.
+*/
+TimingProfile Profile_Tables[2][profileCount];
+std::atomic<const TimingProfile *> Active_Profiles(DEFAULT_PROFILES);
+
+int loadProfiles(const char *_path) {
+    FILE *_file = fopen(_path, "r");
+    if (!_file) {
+        printf("could not open timing profiles %s\n", _path);
+        return -1;
+    }
+
+    const TimingProfile *_active = Active_Profiles.load(std::memory_order_acquire);
+    TimingProfile *_profiles = _active == Profile_Tables[0] ? Profile_Tables[1] : Profile_Tables[0];
+    for (int i = 0; i < profileCount; i++)
+        _profiles[i] = DEFAULT_PROFILES[i]; // positions not in the file keep the built in profile
+
+    char _line[256];
+    int _lineNumber = 0;
+    bool _good = true;
+    while (_good && fgets(_line, sizeof(_line), _file)) {
+        _lineNumber++;
+        char *_comment = strchr(_line, '#');
+        if (_comment)
+            *_comment = '\0';
+
+        char _rotationName[16];
+        int _position = -1;
+        int _used = 0;
+        int _fields = sscanf(_line, " %d %15s %n", &_position, _rotationName, &_used);
+        if (_fields == EOF)
+            continue; // blank or comment line
+
+        TimingProfile _profile = { -1, 0, {} };
+        for (int i = 0; _fields == 2 && i < countOf(RotationNames); i++) {
+            if (strcmp(_rotationName, RotationNames[i]) == 0)
+                _profile.rotation = i;
+        }
+        char *_next = _line + _used;
+        for (;;) {
+            char *_end;
+            long _millis = strtol(_next, &_end, 10);
+            if (_end == _next)
+                break;
+            if (_millis <= 0 || _millis > maxStepMillis || _profile.stepCount >= maxSequenceSteps) {
+                _profile.stepCount = 0;
+                break;
+            }
+            _profile.stepMicros[_profile.stepCount++] = _millis * 1000; // ms to us
+            _next = _end;
+        }
+        while (*_next == ' ' || *_next == '\t' || *_next == '\r' || *_next == '\n')
+            _next++;
+
+        if (_profile.rotation == rotateRandom && _profile.stepMicros[0] > maxRandomStepMillis * 1000u)
+            _profile.stepCount = 0; // a random step lasts up to PARTY_MAX_STEPS of this
+        if (_position < 0 || _position >= profileCount || _profile.rotation < 0
+            || _profile.stepCount == 0 || *_next != '\0') {
+            printf("%s:%d: bad profile, expected position rotation milliseconds... up to %d ms a step, %d for random\n",
+                _path, _lineNumber, maxStepMillis, maxRandomStepMillis);
+            _good = false;
+            break;
+        }
+        _profiles[_position] = _profile;
+    }
+    fclose(_file);
+    if (!_good)
+        return -1; // the running profiles are kept
+
+    Active_Profiles.store(_profiles, std::memory_order_release);
+    return 0;
+}
+
+/*
+ * WAVE PLAYBACK
+ * 	When started with -w a whole cycle of the running sequence is built
+ * 		into one pigpio DMA wave and sent on repeat. The DMA engine does
+ * 		the timing to the microsecond and no CPU is used per step.
+ * 	The wave is only rebuilt when the mode dial or a bias switch changes,
+ * 		the new wave replaces the old one straight away.
+ * 	Every head steps together in the wave, head offsets are not applied.
+*/
+/*
+ * PROGRAMS
+ * 	With -x the scheduler runs a compiled sequence program (see
+ * 		SequenceProgram.h) instead of the direction functions and timing
+ * 		profiles, each step is one record fetch from the mapped file.
+ * 	A head that changes dial position, or meets a newly loaded program,
+ * 		starts again from that position's entry step. Loads are told
+ * 		apart by generation, a new mapping can land at an old address.
+ * 	SIGHUP maps the file again, the old mapping is kept until the reload
+ * 		after so a step being taken from it is never pulled away. As with
+ * 		the timing profiles, reloads must be further apart than one timer
+ * 		callback.
+ * 	Safe flashing after a lamp fault and -w still use the built in
+ * 		sequences.
+*/
+struct LoadedProgram {
+    const ProgramHeader *program; // NULL when the slot is empty
+    size_t bytes;
+    uint32_t generation; // counts loads from 1
+};
+
+// the running program and the one before it, a load replaces whichever is not running
+LoadedProgram Loaded_Programs[2];
+std::atomic<const LoadedProgram *> Active_Program(NULL); // NULL when no program is loaded
+uint32_t Program_Generation = 0;
+
+// checks everything the interpreter relies on, so it never has to
+const char *checkProgram(const ProgramHeader *_program, size_t _bytes) {
+    if (_bytes < sizeof(ProgramHeader) || memcmp(_program->magic, programMagic, sizeof(_program->magic)) != 0)
+        return "not a sequence program";
+    if (_program->version != programVersion)
+        return "program was compiled for another version";
+    if (_program->positions != countOf(Modes))
+        return "program does not have one position per mode pin";
+    if (_program->stepCount == 0 || _bytes != sizeof(ProgramHeader) + _program->stepCount * sizeof(ProgramStep))
+        return "program is the wrong size";
+    const ProgramStep *_steps = (const ProgramStep *)(_program + 1);
+    if (programChecksum(_steps, _program->stepCount) != _program->checksum)
+        return "program checksum does not match";
+    for (int i = 0; i < _program->positions; i++) {
+        if (_program->entry[i] >= _program->stepCount)
+            return "program has an entry past its steps";
+    }
+    for (int i = 0; i < _program->stepCount; i++) {
+        uint32_t _longest = (_steps[i].flags & stepRandom) ? maxRandomStepMillis * 1000u : maxStepMillis * 1000u;
+        if (_steps[i].next >= _program->stepCount || _steps[i].micros == 0 || _steps[i].micros > _longest
+            || (_steps[i].output & ~0b111))
+            return "program has a bad step";
+    }
+    return NULL;
+}
+
+int loadProgram(const char *_path) {
+    int _fd = open(_path, O_RDONLY);
+    struct stat _stat;
+    if (_fd < 0 || fstat(_fd, &_stat) < 0 || _stat.st_size < (off_t)sizeof(ProgramHeader)) {
+        printf("could not open sequence program %s\n", _path);
+        if (_fd >= 0)
+            close(_fd);
+        return -1;
+    }
+    size_t _bytes = _stat.st_size;
+    void *_map = mmap(NULL, _bytes, PROT_READ, MAP_PRIVATE, _fd, 0);
+    close(_fd); // the mapping keeps the file open
+    if (_map == MAP_FAILED) {
+        printf("could not map sequence program %s\n", _path);
+        return -1;
+    }
+    const ProgramHeader *_program = (const ProgramHeader *)_map;
+    const char *_problem = checkProgram(_program, _bytes);
+    if (_problem) {
+        printf("%s: %s\n", _path, _problem);
+        munmap(_map, _bytes);
+        return -1; // the running program is kept
+    }
+
+    LoadedProgram &_slot = Loaded_Programs[Active_Program.load(std::memory_order_relaxed) == &Loaded_Programs[0] ? 1 : 0];
+    if (_slot.program)
+        munmap((void *)_slot.program, _slot.bytes); // the program before the running one
+    _slot.program = _program;
+    _slot.bytes = _bytes;
+    _slot.generation = ++Program_Generation;
+    Active_Program.store(&_slot, std::memory_order_release);
+    return 0;
+}
+
+// shows a head's next program step and moves it on, the program's version of a direction function
+void runProgram(LightHead &_head, const LoadedProgram &_loaded, int _position, int _biasIndex) {
+    const ProgramHeader *_program = _loaded.program;
+    if (_head.programGeneration != _loaded.generation || _head.programPosition != _position) {
+        _head.programGeneration = _loaded.generation;
+        _head.programPosition = _position;
+        _head.programStep = _program->entry[_position];
+    }
+    const ProgramStep &_step = ((const ProgramStep *)(_program + 1))[_head.programStep];
+    _head.programStep = _step.next;
+
+    uint8_t _output = _step.output;
+    _head.stepMicros = _step.micros;
+    if (_step.flags & stepRandom) {
+        uint32_t _random = partyRandom();
+        _output = _random & 0b111;
+        _head.stepMicros *= 1 + (_random >> 3) % PARTY_MAX_STEPS;
+    }
+    updateLights(_head, (_step.flags & stepNoBias) ? _output : OUTPUT_LUT.output[_biasIndex][_output]);
+}
+
+bool Wave_Playback = false;
+
+void refreshWave(void) {
+    if (!Wave_Playback)
         return;
 
-    // defines what each mode changes
-    switch (_pin)
+    // every head follows the same dial, so the profile comes from the first
+    uint32_t _state = Heads[0].state.load(std::memory_order_acquire);
+    const TimingProfile &_profile = Active_Profiles.load(std::memory_order_acquire)[stateProfile(_state)];
+    int _biasIndex[maxHeads];
+    for (int h = 0; h < Head_Count; h++)
+        _biasIndex[h] = stateBiasIndex(Heads[h].state.load(std::memory_order_acquire));
+
+    GpioPulse _pulses[maxSequenceSteps];
+    int _steps = 0;
+    const Sequence *_sequence = RotationSequences[_profile.rotation];
+    if (_sequence) {
+        for (_steps = 0; _steps < _sequence->length; _steps++) {
+            uint32_t _onBits = 0;
+            for (int h = 0; h < Head_Count; h++)
+                _onBits |= Heads[h].lightBits[OUTPUT_LUT.output[_biasIndex[h]][_sequence->steps[_steps]]];
+            _pulses[_steps].onBits = _onBits;
+            _pulses[_steps].offBits = All_Light_Bits & ~_onBits;
+            _pulses[_steps].usDelay = _profile.stepMicros[_steps % _profile.stepCount];
+        }
+    } else {
+        // party mode, a loop of random patterns and times
+        for (_steps = 0; _steps < maxSequenceSteps; _steps++) {
+            uint32_t _random = partyRandom();
+            uint32_t _onBits = 0;
+            for (int h = 0; h < Head_Count; h++)
+                _onBits |= Heads[h].lightBits[OUTPUT_LUT.output[_biasIndex[h]][(_random >> (h * 3)) & 0b111]];
+            _pulses[_steps].onBits = _onBits;
+            _pulses[_steps].offBits = All_Light_Bits & ~_onBits;
+            _pulses[_steps].usDelay = (1 + (_random >> 24) % PARTY_MAX_STEPS) * _profile.stepMicros[0];
+        }
+    }
+
+    // a preemption holds the lights, its release rebuilds the wave
+    pthread_mutex_lock(&Lights_Lock);
+    int _result = Preempt_Active ? 0 : Gpio->sendWave(_pulses, _steps);
+    pthread_mutex_unlock(&Lights_Lock);
+    if (_result < 0)
+        printf("could not create light wave (%d)\n", _result); // the old wave keeps running
+}
+
+/*
+ * Takes one step on every head straight away, each with the bias from its
+ * own state snapshot, then writes the lights of all of them at once.
+*/
+void stepHeads(DirectionFunction _direction) {
+    const TimingProfile *_profiles = Active_Profiles.load(std::memory_order_acquire);
+    for (int h = 0; h < Head_Count; h++) {
+        uint32_t _state = Heads[h].state.load(std::memory_order_acquire);
+        Heads[h].profile = &_profiles[stateProfile(_state)];
+        _direction(Heads[h], stateBiasIndex(_state));
+    }
+    commitLights();
+}
+
+/*
+ * LAMP FEEDBACK
+ * 	Heads with sense inputs in the pin map are checked by their own timer
+ * 		(timer 1) every feedbackPeriod ms, well away from the scheduler.
+ * 		One read of the bank gives every sense input, each is compared
+ * 		with whether its lamp was last written on.
+ * 	A lamp that reads dark while lit for faultSamples samples in a row has
+ * 		failed and is added to Failed_Lamps. The first failed red lamp
+ * 		puts every head onto safe flashing (FAULT_PROFILE) at the next
+ * 		scheduler pass, which holds until the program is restarted.
+ * 	With -w nothing is written by the scheduler to compare against, so
+ * 		feedback is not sampled.
+*/
+std::atomic<uint32_t> Failed_Lamps(0); // bank bits of every lamp found failed, never cleared
+bool Fault_Shown = false; // the scheduler has moved every head onto FAULT_PROFILE, timer callback only
+
+void sampleFeedback(void) {
+    if (Watchdog_Tripped.load(std::memory_order_relaxed))
+        return; // the safe state wave is driving the lamps, not the scheduler
+    uint32_t _bank = Gpio->readBank();
+    uint32_t _lit = Shown_Lights.load(std::memory_order_relaxed);
+    uint32_t _known = Failed_Lamps.load(std::memory_order_relaxed); // only this timer adds to it
+    uint32_t _failed = 0;
+    for (int h = 0; h < Head_Count; h++) {
+        LightHead &_head = Heads[h];
+        for (int i = 0; i < 3; i++) {
+            if (!_head.senseBits[i] || (_known & (1u << _head.lights[i])))
+                continue; // lamp without a sense input, or already reported
+            bool _dark = (_lit & (1u << _head.lights[i])) && !(_bank & _head.senseBits[i]);
+            _head.darkSamples[i] = _dark ? _head.darkSamples[i] + 1 : 0;
+            if (_head.darkSamples[i] == faultSamples) {
+                _failed |= 1u << _head.lights[i];
+                logEvent(eventFault, _head.lights[i], 0, h, _lit, Gpio->tick());
+                printf("lamp on gpio %d of head %d has failed\n", _head.lights[i], h);
+            }
+        }
+    }
+    if (_failed)
+        Failed_Lamps.fetch_or(_failed, std::memory_order_relaxed);
+}
+
+// starts (or restarts) sampling every _period ms if any head has sense inputs
+void startFeedback(unsigned _period) {
+    for (int h = 0; h < Head_Count; h++) {
+        for (uint32_t _bit : Heads[h].senseBits) {
+            if (_bit) {
+                Gpio->setTimer(1, _period, sampleFeedback);
+                return;
+            }
+        }
+    }
+}
+
+// publishes the profile of a dial position to every head
+void selectProfile(int _profile) {
+    for (int h = 0; h < Head_Count; h++)
+        publishState(Heads[h], STATE_PROFILE_BITS, makeState(0, 0, _profile));
+}
+
+/*
+ * COMMAND QUEUE
+ * 	Commands from the network (ControlSocket.cpp) are handed to the timer
+ * 		callback through a single producer single consumer ring. The
+ * 		network thread only ever writes Command_Head and the timer
+ * 		callback only ever writes Command_Tail, so neither side waits on
+ * 		the other and a flood of commands can only fill the ring.
+ * 	Commands are applied at the start of each scheduler pass and take the
+ * 		same paths as the mode dial and bias switches, the lights change
+ * 		at each head's next step. With -w there is no scheduler pass so
+ * 		commands have no effect.
+*/
+#define commandQueueSize 64 // must be a power of two
+
+ControlCommand Command_Queue[commandQueueSize];
+std::atomic<uint32_t> Command_Head(0); // next slot to write, network thread only
+std::atomic<uint32_t> Command_Tail(0); // next slot to read, timer callback only
+
+int queueCommand(const ControlCommand &_command) {
+    switch (_command.type)
     {
-    default:
+    case commandMode:
+        if (_command.value < 0 || _command.value >= profileCount)
+            return -1;
         break;
-    case modeRand:
+    case commandBias:
+        if (_command.head < 0 || _command.head >= Head_Count
+            || (_command.value & ~0b111) || (_command.value2 & ~0b111))
+            return -1;
         break;
+    default:
+        return -1;
+    }
 
-    case modeDownSlow:
-        _speed = slowSpeed;
-        _rotation = rotateDown;
-        break;
-    case modeDownMedium:
-        _speed = mediumSpeed;
-        _rotation = rotateDown;
-        break;
-    case modeDownFast:
-        _speed = fastSpeed;
-        _rotation = rotateDown;
-        break;
+    uint32_t _head = Command_Head.load(std::memory_order_relaxed);
+    if (_head - Command_Tail.load(std::memory_order_acquire) >= commandQueueSize)
+        return -2; // full, the timer callback has not caught up
+    Command_Queue[_head & (commandQueueSize - 1)] = _command;
+    Command_Head.store(_head + 1, std::memory_order_release);
+    return 0;
+}
 
-    case modeUpSlow:
-        _speed = slowSpeed;
-        _rotation = rotateUp;
-        break;
-    case modeUpMedium:
-        _speed = mediumSpeed;
-        _rotation = rotateUp;
-        break;
-    case modeUpFast:
-        _speed = fastSpeed;
-        _rotation = rotateUp;
-        break;
+void applyCommands(void) {
+    uint32_t _tail = Command_Tail.load(std::memory_order_relaxed);
+    uint32_t _head = Command_Head.load(std::memory_order_acquire);
+    for (; _tail != _head; _tail++) {
+        const ControlCommand &_command = Command_Queue[_tail & (commandQueueSize - 1)];
+        switch (_command.type)
+        {
+        case commandMode:
+            selectProfile(_command.value);
+            break;
+        case commandBias:
+            publishState(Heads[_command.head], STATE_BIAS_BITS, makeState(_command.value, _command.value2, 0));
+            break;
+        }
+    }
+    Command_Tail.store(_tail, std::memory_order_release);
+}
 
-    case modeFlashSlow:
-        _speed = slowSpeed;
-        _rotation = rotateNone;
-        break;
-    case modeFlashMedium:
-        _speed = mediumSpeed;
-        _rotation = rotateNone;
-        break;
-    case modeFlashFast:
-        _speed = fastSpeed;
-        _rotation = rotateNone;
-        break;
+/*
+ * One line describing the profile, lights and bias of every head, e.g.
+ * "profile 2 lights 00000004 failed 00000000 bias 0:0/7\n". Only reads published state so any
+ * thread can call it. Returns the length written.
+*/
+int formatTelemetry(char *_buffer, int _size) {
+    int _length = snprintf(_buffer, _size, "profile %d lights %08x failed %08x bias",
+        stateProfile(Heads[0].state.load(std::memory_order_relaxed)),
+        Shown_Lights.load(std::memory_order_relaxed),
+        Failed_Lamps.load(std::memory_order_relaxed));
+    for (int h = 0; h < Head_Count && _length < _size; h++) {
+        int _biasIndex = stateBiasIndex(Heads[h].state.load(std::memory_order_relaxed));
+        _length += snprintf(_buffer + _length, _size - _length, " %d:%o/%o", h, _biasIndex >> 3, _biasIndex & 0b111);
     }
-    
-    gpioSetTimerFunc(0, _speed, _directionFunction[_rotation]); //start timer with new conditions
+    if (_length < _size)
+        _length += snprintf(_buffer + _length, _size - _length, "\n");
+    return _length < _size ? _length : _size - 1;
 }
 
+/*
+ * The counters and state in the Prometheus text format, see METRICS.
+*/
+// snprintf onto the end of _buffer, _length stops growing once it is full
+__attribute__((format(printf, 4, 5)))
+void appendText(char *_buffer, int _size, int &_length, const char *_format, ...) {
+    if (_length >= _size)
+        return;
+    va_list _values;
+    va_start(_values, _format);
+    _length += vsnprintf(_buffer + _length, _size - _length, _format, _values);
+    va_end(_values);
+}
 
+int formatMetrics(char *_buffer, int _size) {
+    int _length = 0;
 
-void setup() {
-    // set Lights as outputs
-    for (int i = 0; i < sizeof(Lights); i++) {
-        gpioSetMode(Lights[i], PI_OUTPUT);
-        gpioSetPullUpDown(Lights[i], PI_PUD_UP)
+    appendText(_buffer, _size, _length, "# TYPE trafficpi_steps_total counter\n");
+    for (int i = 0; i < metricRotations; i++) {
+        uint64_t _sum = 0;
+        for (const MetricSlot &_slot : Metric_Slots)
+            _sum += _slot.steps[i].load(std::memory_order_relaxed);
+        appendText(_buffer, _size, _length, "trafficpi_steps_total{rotation=\"%s\"} %llu\n",
+            i < countOf(RotationNames) ? RotationNames[i] : "program", (unsigned long long)_sum);
+    }
+    const struct {
+        const char *name;
+        std::atomic<uint64_t> MetricSlot::*counter;
+    } _counters[] = {
+        { "trafficpi_scheduler_passes_total", &MetricSlot::passes },
+        { "trafficpi_scheduler_overruns_total", &MetricSlot::overruns },
+        { "trafficpi_mode_changes_total", &MetricSlot::modeChanges },
+        { "trafficpi_bias_edges_total", &MetricSlot::biasEdges },
+        { "trafficpi_preemptions_total", &MetricSlot::preemptions },
+    };
+    for (const auto &_counter : _counters)
+        appendText(_buffer, _size, _length, "# TYPE %s counter\n%s %llu\n", _counter.name, _counter.name, (unsigned long long)sumMetric(_counter.counter));
+
+    const struct {
+        const char *name;
+        uint32_t value;
+    } _gauges[] = {
+        { "trafficpi_output_mask", Shown_Lights.load(std::memory_order_relaxed) },
+        { "trafficpi_failed_lamps", Failed_Lamps.load(std::memory_order_relaxed) },
+        { "trafficpi_profile", (uint32_t)stateProfile(Heads[0].state.load(std::memory_order_relaxed)) },
+        { "trafficpi_safe_state", Watchdog_Tripped.load(std::memory_order_relaxed) },
+    };
+    for (const auto &_gauge : _gauges)
+        appendText(_buffer, _size, _length, "# TYPE %s gauge\n%s %u\n", _gauge.name, _gauge.name, _gauge.value);
+    return _length < _size ? _length : _size - 1;
+}
+
+/*
+ * SCHEDULER
+ * 	Timer 0 is started once and never torn down. Every schedulerResolution
+ * 		ms it reads gpioTick() and steps every head whose deadline has
+ * 		passed in one pass, then writes the lights of all of them at once.
+ * 	Deadlines are absolute ticks, each one is the last deadline plus the
+ * 		step length, so heads never drift from each other or from their
+ * 		offsets however late the timer callback runs.
+ * 	A mode change or profile reload only changes the profile, each head
+ * 		picks it up at its next step so it keeps its phase.
+*/
+int Tick_Rotation = -1; // rotation of the last step taken
+
+void sequenceTick(void) {
+    Heartbeat.store(Heartbeat.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed); // see WATCHDOG
+    uint32_t _now = Gpio->tick();
+    applyCommands();
+
+    // a failed red lamp holds every head on safe flashing, starting straight away
+    bool _fault = Failed_Lamps.load(std::memory_order_relaxed) & Red_Light_Bits;
+    if (_fault && !Fault_Shown) {
+        for (int h = 0; h < Head_Count; h++)
+            Heads[h].due = _now;
+        Fault_Shown = true;
     }
 
-    // bias switches (input, pin pull up, call function to apply changes)
-    for (int i = 0; i < sizeof(OnBias); i++) {
-        gpioSetMode(OnBias[i], PI_INPUT);
-        gpioSetPullUpDown(OnBias[i], PI_PUD_UP);
-        gpioSetAlertFunc(OnBias[i], updateOnBias);
+    // every head follows the same dial so the rotation comes from the first
+    const TimingProfile *_profiles = Active_Profiles.load(std::memory_order_acquire);
+    int _rotation = _fault ? FAULT_PROFILE.rotation
+        : _profiles[stateProfile(Heads[0].state.load(std::memory_order_acquire))].rotation;
+    if (_rotation != Tick_Rotation && _rotation == rotateRandom)
+        Party_State = _now | 1; // never seed xorshift with 0
+    Tick_Rotation = _rotation;
+    DirectionFunction _direction = DirectionFunctions[_rotation];
+    const LoadedProgram *_program = Active_Program.load(std::memory_order_acquire);
+
+    MetricSlot &_metrics = threadMetrics();
+    countMetric(_metrics.passes);
+    int _steps = 0;
+    int _overruns = 0;
+    for (int h = 0; h < Head_Count; h++) {
+        LightHead &_head = Heads[h];
+        uint32_t _late = _now - _head.due;
+        if ((int32_t)_late < 0)
+            continue; // not due yet
+        if (Measure_Latency)
+            recordLatency(Tick_Jitter, _late);
+        if (_late > schedulerResolution * 1000)
+            _overruns++;
+
+        uint32_t _state = _head.state.load(std::memory_order_acquire);
+        if (_program && !_fault) {
+            runProgram(_head, *_program, stateProfile(_state), stateBiasIndex(_state));
+        } else {
+            _head.profile = _fault ? &FAULT_PROFILE : &_profiles[stateProfile(_state)];
+            _direction(_head, stateBiasIndex(_state));
+        }
+
+        // skip any whole steps we were too late for, keeping the phase
+        _head.due += _head.stepMicros * (1 + _late / _head.stepMicros);
+        _steps++;
+    }
+    if (_steps) {
+        countMetric(_metrics.steps[_program && !_fault ? metricRotations - 1 : _rotation], _steps);
+        if (_overruns)
+            countMetric(_metrics.overruns, _overruns);
+        commitLights();
+    }
+}
+
+void startScheduler(void) {
+    uint32_t _now = Gpio->tick();
+    for (int h = 0; h < Head_Count; h++)
+        Heads[h].due = _now + Heads[h].offset;
+    sequenceTick(); // heads with no offset show their first step now, not a tick later
+    Gpio->setTimer(0, schedulerResolution, sequenceTick);
+}
+
+/*
+ * MODE DIAL
+ * 	The dial position is decoded from one read of the bank. Each byte of the
+ * 		bank indexes a table of the dial positions whose pins are in it, the
+ * 		four lookups ORed together are every position reading high.
+ * 	Exactly one high is a position, its TimingProfile (or program entry) is
+ * 		what it runs. None high (between detents) or more than one (a
+ * 		contact still bouncing) is no position and the mode is left as it
+ * 		is, so the result only depends on the levels at the read and not
+ * 		on the order the edges arrived in.
+*/
+struct ModeTable {
+    uint16_t positions[4][256]; // dial positions high for each value of each bank byte
+    int8_t position[32]; // dial position of each pin, -1 if it is not a mode pin
+};
+static_assert(countOf(Modes) <= 16, "dial positions must fit the table");
+
+constexpr ModeTable buildModeTable() {
+    ModeTable _table = {};
+    for (int _pin = 0; _pin < 32; _pin++)
+        _table.position[_pin] = -1;
+    for (int i = 0; i < countOf(Modes); i++) {
+        _table.position[Modes[i]] = (int8_t)i;
+        for (int _value = 0; _value < 256; _value++) {
+            if (_value & (1 << (Modes[i] % 8)))
+                _table.positions[Modes[i] / 8][_value] |= (uint16_t)(1u << i);
+        }
+    }
+    return _table;
+}
+
+constexpr ModeTable MODE_LUT = buildModeTable();
+
+// dial position selected in a bank read, -1 if no one pin reads high
+inline int decodeMode(uint32_t _bank) {
+    uint32_t _positions = MODE_LUT.positions[0][_bank & 0xFF] | MODE_LUT.positions[1][(_bank >> 8) & 0xFF]
+        | MODE_LUT.positions[2][(_bank >> 16) & 0xFF] | MODE_LUT.positions[3][_bank >> 24];
+    if (_positions == 0 || (_positions & (_positions - 1)))
+        return -1;
+    return __builtin_ctz(_positions);
+}
+
+/*
+ * Called when the mode dial has changed. Sets the new condition which the
+ * scheduler picks up at the next step, the timer itself is left running.
+*/
+void updateTimerMode(int _pin, int _level, uint32_t _tick) 
+{
+    // Only looking for _level == 1 since that means a new mode has been selected
+    if (_level != 1 || _pin == Current_Mode || _pin < 0 || _pin >= 32)
+        return;
+
+    // the position of the pin on the dial is the profile it selects
+    int _profile = MODE_LUT.position[_pin];
+    if (_profile < 0)
+        return; // not a mode pin
+    Current_Mode = _pin;
+    recordEdge(_tick);
+    countMetric(threadMetrics().modeChanges);
+    logEvent(eventMode, _pin, _level, _profile, Shown_Lights.load(std::memory_order_relaxed), _tick);
+
+    selectProfile(_profile);
+    refreshWave(); //with -w the DMA does the timing instead of the scheduler
+}
+
+
+
+/*
+ * LOW POWER
+ * 	With -z a slow flashing profile (rotation flash, every step at least
+ * 		lowPowerStepMillis) is taken as night running. Once the dial has
+ * 		settled on one:
+ * 		- the scheduler ticks every lowPowerResolution ms, deadlines are
+ * 		  absolute so the flash keeps its phase, only landing later
+ * 		- lamp feedback is sampled every lowPowerFeedbackPeriod ms
+ * 		- every cpufreq policy is moved to the powersave governor
+ * 	The first edge of the mode dial puts it all back, before the new mode
+ * 		settles and is applied. teardown() puts the governors back too,
+ * 		so stopping at night does not leave the Pi on powersave.
+ * 	Only the dial path changes the power state, a mode command from the
+ * 		network does not, and a -x program is never taken as night
+ * 		running. With -w the DMA does the timing and the scheduler never
+ * 		runs, so -z does nothing.
+ * 	pigpio's sample rate is fixed when it initialises, -s sets it for the
+ * 		whole run.
+*/
+#define maxCpuPolicies 8
+#define governorPath "/sys/devices/system/cpu/cpufreq/policy%d/scaling_governor"
+
+bool Low_Power = false;
+bool Low_Power_Running = false; // alert callbacks and teardown() only
+char Saved_Governors[maxCpuPolicies][32]; // "" for policies not changed
+
+// writes a governor to policy _policy, false if it does not exist or would not take it
+bool writeGovernor(int _policy, const char *_governor) {
+    char _path[96];
+    snprintf(_path, sizeof(_path), governorPath, _policy);
+    FILE *_file = fopen(_path, "w");
+    if (!_file)
+        return false;
+    bool _written = fputs(_governor, _file) >= 0;
+    return fclose(_file) == 0 && _written;
+}
+
+void enterLowPower(void) {
+    Low_Power_Running = true;
+    Gpio->setTimer(0, lowPowerResolution, sequenceTick);
+    startFeedback(lowPowerFeedbackPeriod);
 
-        // since sizeof(OnBias) == sizeof(OffBias)
-        gpioSetMode(OffBias[i], PI_INPUT);
-        gpioSetPullUpDown(OffBias[i], PI_PUD_UP);
-        gpioSetAlertFunc(OffBias[i], updateOffBias);
+    int _changed = 0;
+    for (int i = 0; i < maxCpuPolicies; i++) {
+        Saved_Governors[i][0] = '\0';
+        char _path[96];
+        snprintf(_path, sizeof(_path), governorPath, i);
+        FILE *_file = fopen(_path, "r");
+        if (!_file)
+            continue;
+        char _governor[32] = "";
+        bool _read = fgets(_governor, sizeof(_governor), _file) != NULL;
+        fclose(_file);
+        _governor[strcspn(_governor, "\n")] = '\0';
+        if (_read && writeGovernor(i, "powersave")) {
+            strcpy(Saved_Governors[i], _governor);
+            _changed++;
+        }
+    }
+    printf("low power: scheduler every %d ms, %d cpu policies on powersave\n", lowPowerResolution, _changed);
+}
+
+// puts back every governor enterLowPower() changed
+void restoreGovernors(void) {
+    for (int i = 0; i < maxCpuPolicies; i++) {
+        if (Saved_Governors[i][0] && !writeGovernor(i, Saved_Governors[i]))
+            printf("low power: could not put back the %s governor on policy %d\n", Saved_Governors[i], i);
+        Saved_Governors[i][0] = '\0';
     }
+}
 
-    // sequence mode selecters (input, pin pull up, function changes timer)
-    for (int i = 0; i < sizeof(Modes); i++) {
-        gpioSetMode(Modes[i], PI_INPUT);
-        gpioSetPullUpDown(Modes[i], PI_PUD_UP);
-        gpioSetAlertFunc(Modes[i], updateTimerMode);
+void leaveLowPower(void) {
+    if (!Low_Power_Running || Wave_Playback)
+        return;
+    Low_Power_Running = false;
+    Gpio->setTimer(0, schedulerResolution, sequenceTick);
+    startFeedback(feedbackPeriod);
+    restoreGovernors();
+    printf("low power: off\n");
+}
+
+// enters low power if the running profile is night running, called once the dial has settled
+void updateLowPower(void) {
+    if (!Low_Power || Low_Power_Running || Wave_Playback || Active_Program.load(std::memory_order_acquire))
+        return;
+    uint32_t _state = Heads[0].state.load(std::memory_order_acquire); // every head follows the same dial
+    const TimingProfile &_profile = Active_Profiles.load(std::memory_order_acquire)[stateProfile(_state)];
+    if (_profile.rotation != rotateNone)
+        return;
+    for (int i = 0; i < _profile.stepCount; i++) {
+        if (_profile.stepMicros[i] < lowPowerStepMillis * 1000u)
+            return;
     }
+    enterLowPower();
+}
 
-    //Set current mode to reflect selecter
-    for each (int i in Modes) //read input pins for mode selection
+/*
+ * Software settle window for the mode dial.
+ * A turn of the dial gives a burst of edges across several mode pins. Each
+ * edge (re)arms a pigpio watchdog on the pin that moved, when the dial has
+ * been quiet for modeSettleTime the watchdog fires (level 2) and the dial
+ * is read once and applied, so one physical change is one mode change.
+*/
+int Settle_Pin = -1; // mode pin that currently has the settle watchdog armed
+uint32_t Settle_Tick = 0; // tick of the last edge, passed on as when the mode changed
+
+void debounceMode(int _pin, int _level, uint32_t _tick) {
+    switch (_level)
     {
-        if (!gpioRead(i))
+    case 0:
+    case 1: // dial moved, restart the settle window on this pin
+        leaveLowPower();
+        if (Settle_Pin != _pin && Settle_Pin >= 0)
+            Gpio->setWatchdog(Settle_Pin, 0);
+        Settle_Pin = _pin;
+        Settle_Tick = _tick;
+        Gpio->setWatchdog(_pin, modeSettleTime);
+        break;
+
+    default:
+    case 2: // dial has settled
+        Gpio->setWatchdog(_pin, 0);
+        Settle_Pin = -1;
+
+        int _position = decodeMode(Gpio->readBank());
+        if (_position >= 0)
+            updateTimerMode(Modes[_position], 1, Settle_Tick);
+        updateLowPower();
+        break;
+    }
+}
+
+/*
+ * Applies the glitch filter for a pin, using an override if it has one
+*/
+void setDebounce(int _pin, unsigned _steady) {
+    for (const PinDebounce &_override : DebounceOverrides) {
+        if (_override.pin == _pin)
+            _steady = _override.steady;
+    }
+    Gpio->setGlitchFilter(_pin, _steady);
+}
+
+void setup() {
+    // one head on the default pins if no pin map was loaded, its pins were checked and its tables built at compile time
+    if (Head_Count == 0)
+        addCheckedHead(DefaultWiring::pins, DefaultWiring::pinCount, 0, NULL, DefaultWiring::lightBits, DefaultWiring::pinsUsed);
+
+    // every pin in one table: lights are outputs, lamp sense inputs have the
+    // pull down on and are only polled, the rest are inputs with the pull up
+    // on, a glitch filter and the callback that handles them
+    struct PinSetup {
+        int pin;
+        unsigned steady; // glitch filter default, microseconds
+        GpioAlertFunction alert; // NULL for an output or sense input
+        bool sense;
+    };
+    PinSetup _pins[maxHeads * 12 + countOf(Modes) + 1];
+    int _pinCount = 0;
+    for (int h = 0; h < Head_Count; h++) {
+        const LightHead &_head = Heads[h];
+        for (int i = 0; i < 3; i++) {
+            _pins[_pinCount++] = { _head.lights[i], 0, NULL, false };
+            if (_head.sense[i] != noPin)
+                _pins[_pinCount++] = { _head.sense[i], 0, NULL, true };
+            if (_head.onBias[i] == noPin)
+                continue; // head without bias switches
+            _pins[_pinCount++] = { _head.onBias[i], biasGlitchTime, updateOnBias, false };
+            _pins[_pinCount++] = { _head.offBias[i], biasGlitchTime, updateOffBias, false };
+        }
+    }
+    for (int _mode : Modes)
+        _pins[_pinCount++] = { _mode, modeGlitchTime, debounceMode, false }; // debounce then change timer
+    if (preemptPin != noPin && preemptHead < Head_Count) {
+        _pins[_pinCount++] = { preemptPin, preemptGlitchTime, updatePreempt, false };
+        for (int h = 0; h < Head_Count; h++)
+            Preempt_Bits |= Heads[h].lightBits[h == preemptHead ? 0b001 : 0b100];
+    } else if (preemptPin != noPin) {
+        printf("preemption head %d is not in the pin map, preemption is off\n", preemptHead);
+    }
+
+    Gpio->clearBank(All_Light_Bits); // lights start off, not however they were left
+    uint32_t _inputBits = 0; // pins with a callback, their levels are logged below
+    for (int i = 0; i < _pinCount; i++) {
+        if (_pins[i].sense) {
+            Gpio->setSenseInput(_pins[i].pin); // a sensor that comes loose reads as a dark lamp
+            continue;
+        }
+        if (!_pins[i].alert) {
+            Gpio->setOutput(_pins[i].pin);
             continue;
-        else //only 1 pin that is high can be selected
-        {
-            updateTimerMode(i, 1, 1234);
-            break;
         }
+        Gpio->setInput(_pins[i].pin);
+        setDebounce(_pins[i].pin, _pins[i].steady);
+        Gpio->setAlert(_pins[i].pin, _pins[i].alert);
+        _inputBits |= pinBit(_pins[i].pin);
     }
+
+    // the bias masks and the mode come from one read of the bank, taken after
+    // the alerts are on so a change from here on is never missed, and logged
+    // so a replay can start from the same levels
+    uint32_t _tick = Gpio->tick();
+    uint32_t _bank = Gpio->readBank();
+    applyBias(_bank);
+    int _position = decodeMode(_bank);
+    logEvent(eventStartup, _position >= 0 ? Modes[_position] : 0, _position >= 0, _position >= 0 ? _position : 0,
+        _bank & _inputBits, _tick);
+    if (_position >= 0)
+        updateTimerMode(Modes[_position], 1, _tick);
+
+    // wave playback does its own timing
+    if (!Wave_Playback) {
+        startScheduler();
+        startFeedback(feedbackPeriod);
+        startWatchdog();
+        updateLowPower(); // the dial may already be on a night mode
+    }
+    if (Preempt_Bits && !(_bank & (1u << preemptPin)))
+        updatePreempt(preemptPin, 0, Gpio->tick()); // already held low at startup, stops the wave with -w
 }
 
-void loop() {
-	// this is an inturrpt based program.
-    __noop; //no operation
+void teardown() {
+    Gpio->setTimer(0, 10, NULL); //stop the light cycle
+    Gpio->setTimer(1, 10, NULL); //and the lamp feedback
+    Gpio->setTimer(2, 10, NULL); //and the watchdog
+    if (Wave_Playback)
+        Gpio->stopWave();
+    if (Low_Power_Running) {
+        Low_Power_Running = false;
+        restoreGovernors(); // the timers stay stopped
+    }
 }
 
+/*
+ * BATCH SIMULATION
+ * 	Runs many independent controllers at once for planning, each one head
+ * 		with its own profile and bias, stepping on the scheduler's
+ * 		schedulerResolution ticks with the same sequences and the same
+ * 		(step | BIAS_ON_MASK) & BIAS_OFF_MASK output as the direction
+ * 		functions.
+ * 	State is kept as a structure of arrays, batchLanes instances to a
+ * 		vector, and the step is written once with GCC vector extensions
+ * 		so it becomes AVX2 on x86 (-mavx2) and NEON on the Pi (aarch64).
+ * 		Each block of lanes is run for every tick of batchRun() while it
+ * 		is in registers. A tick with no lane due costs a subtract and a
+ * 		test.
+ * 	Time in each output pattern is counted in ticks, added up when a lane
+ * 		steps rather than every tick.
+ * 	Random lanes each have their own xorshift, a step lasts 1 to
+ * 		PARTY_MAX_STEPS of the profile's step as in RotateRandom() but the
+ * 		count is a multiply-high instead of a modulo, vectors have no
+ * 		integer divide.
+*/
+typedef uint32_t BatchVector __attribute__((vector_size(batchLanes * sizeof(uint32_t))));
+typedef int32_t BatchSigned __attribute__((vector_size(batchLanes * sizeof(int32_t))));
 
-int main(void)//(int argc, char **argv)
-{
-	if (wiringPiSetup() < 0) {
-		cout << "setup wiring pi failed" << endl;
-		return 1;
-	}
-	setup();
-	while (1) { //keep program running
-		loop();
-	}
-	gpioTerminate();
+#define batchTickMicros (schedulerResolution * 1000)
+// remaining is signed, the longest step plus a tick of lateness must fit it
+static_assert(maxStepMillis * 1000ull + batchTickMicros < (1ull << 31), "steps must fit the signed lane arithmetic");
 
-	return 0;
+struct BatchSim {
+    int count; // instances, the arrays are padded to whole blocks of batchLanes
+    int blocks;
+    BatchVector *pattern; // steps of the rotation's sequence, 3 bits each from bit 0
+    BatchVector *length; // steps in the sequence, 0 for random
+    BatchVector *stage; // step being shown
+    BatchVector *remaining; // micros until the next step, signed
+    BatchVector *since; // ticks since the last step, not yet counted
+    BatchVector *bias; // BIAS_INDEX, (BIAS_ON_MASK << 3) | BIAS_OFF_MASK
+    BatchVector *shown; // output pattern being shown
+    BatchVector *random; // xorshift state of random lanes
+    BatchVector *stepMicros[maxSequenceSteps]; // duration of each stage
+    BatchVector *ticksIn[8]; // ticks spent showing each output pattern
+    void *memory;
+};
+
+// element _instance of an array of vectors
+inline uint32_t &batchLane(BatchVector *_array, int _instance) {
+    return ((uint32_t *)_array)[_instance];
 }
 
+// true if any lane of a mask is set
+inline bool batchAny(const BatchVector &_mask) {
+#if defined(__AVX2__)
+    __m256i _bits = (__m256i)_mask;
+    return !_mm256_testz_si256(_bits, _bits);
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    uint32x4_t _low = { _mask[0], _mask[1], _mask[2], _mask[3] };
+    uint32x4_t _high = { _mask[4], _mask[5], _mask[6], _mask[7] };
+    return vmaxvq_u32(vorrq_u32(_low, _high)) != 0;
+#elif defined(__SSE2__)
+    const __m128i *_halves = (const __m128i *)&_mask;
+    return _mm_movemask_epi8(_mm_or_si128(_halves[0], _halves[1])) != 0;
+#else
+    uint32_t _any = 0;
+    for (int i = 0; i < batchLanes; i++)
+        _any |= _mask[i];
+    return _any != 0;
+#endif
+}
 
-// rotate bits right by 1
-int rightRotate(int n)
-{
-    unsigned int d = 1;
-    /* In n>>d, first d bits are 0.
-    To put last 3 bits of at
-    first, do bitwise or of n>>d
-    with n <<(INT_BITS - d) */
-    return (n >> d) | (n << (INT_BITS - d));
+// takes effect at the instance's next step, as a profile change does on a head
+static void batchSetTiming(BatchSim *_sim, int _instance, const TimingProfile &_profile) {
+    const Sequence *_sequence = RotationSequences[_profile.rotation];
+    uint32_t _pattern = 0;
+    for (int i = 0; _sequence && i < _sequence->length; i++)
+        _pattern |= (uint32_t)_sequence->steps[i] << (3 * i);
+    batchLane(_sim->pattern, _instance) = _pattern;
+    batchLane(_sim->length, _instance) = _sequence ? _sequence->length : 0;
+    for (int i = 0; i < maxSequenceSteps; i++)
+        batchLane(_sim->stepMicros[i], _instance) = _profile.stepMicros[i % _profile.stepCount];
 }
 
+BatchSim *batchCreate(int _count) {
+    if (_count <= 0)
+        return NULL;
+    int _blocks = (_count + batchLanes - 1) / batchLanes;
+    const int _arrays = 8 + maxSequenceSteps + 8;
+    size_t _bytes = (size_t)_arrays * _blocks * sizeof(BatchVector);
+    void *_memory = aligned_alloc(sizeof(BatchVector), _bytes);
+    BatchSim *_sim = new BatchSim;
+    if (!_memory || !_sim) {
+        free(_memory);
+        delete _sim;
+        return NULL;
+    }
+    memset(_memory, 0, _bytes);
 
-// rotate bits left by 1
-int leftRotate(int n)
-{
-    unsigned int d = 1
-        /* In n<<d, last d bits are 0. To
-         put first 3 bits of n at
-        last, do bitwise or of n<<d
-        with n >>(INT_BITS - d) */
-        return (n << d) | (n >> (INT_BITS - d));
+    BatchVector *_next = (BatchVector *)_memory;
+    BatchVector **_fields[] = { &_sim->pattern, &_sim->length, &_sim->stage, &_sim->remaining,
+        &_sim->since, &_sim->bias, &_sim->shown, &_sim->random };
+    for (BatchVector **_field : _fields) {
+        *_field = _next;
+        _next += _blocks;
+    }
+    for (BatchVector *&_array : _sim->stepMicros) {
+        _array = _next;
+        _next += _blocks;
+    }
+    for (BatchVector *&_array : _sim->ticksIn) {
+        _array = _next;
+        _next += _blocks;
+    }
+    _sim->count = _count;
+    _sim->blocks = _blocks;
+    _sim->memory = _memory;
+
+    // every instance starts like a fresh head, no bias and the built in profile
+    for (int i = 0; i < _blocks * batchLanes; i++) {
+        batchLane(_sim->random, i) = (uint32_t)(i + 1) * 2654435761u | 1; // never seed xorshift with 0
+        batchLane(_sim->bias, i) = stateBiasIndex(initialState);
+        batchLane(_sim->stage, i) = (uint32_t)-1; // first step shows the start of the sequence
+        batchSetTiming(_sim, i, Active_Profiles.load(std::memory_order_acquire)[stateProfile(initialState)]);
+    }
+    return _sim;
+}
+
+void batchDestroy(BatchSim *_sim) {
+    if (!_sim)
+        return;
+    free(_sim->memory);
+    delete _sim;
+}
+
+int batchSetProfile(BatchSim *_sim, int _instance, const char *_rotation, const uint32_t *_stepMillis, int _stepCount) {
+    TimingProfile _profile = { -1, _stepCount, {} };
+    for (int i = 0; i < countOf(RotationNames); i++) {
+        if (strcmp(_rotation, RotationNames[i]) == 0)
+            _profile.rotation = i;
+    }
+    if (_instance < 0 || _instance >= _sim->count || _profile.rotation < 0
+        || _stepCount <= 0 || _stepCount > maxSequenceSteps)
+        return -1;
+    uint32_t _longest = _profile.rotation == rotateRandom ? maxRandomStepMillis : maxStepMillis; // as loadProfiles()
+    for (int i = 0; i < _stepCount; i++) {
+        if (_stepMillis[i] == 0 || _stepMillis[i] > _longest)
+            return -1;
+        _profile.stepMicros[i] = _stepMillis[i] * 1000; // ms to us
+    }
+    batchSetTiming(_sim, _instance, _profile);
+    return 0;
+}
+
+int batchSetPosition(BatchSim *_sim, int _instance, int _position) {
+    if (_instance < 0 || _instance >= _sim->count || _position < 0 || _position >= profileCount)
+        return -1;
+    batchSetTiming(_sim, _instance, Active_Profiles.load(std::memory_order_acquire)[_position]);
+    return 0;
+}
+
+int batchSetBias(BatchSim *_sim, int _instance, int _onMask, int _offMask) {
+    if (_instance < 0 || _instance >= _sim->count || (_onMask & ~0b111) || (_offMask & ~0b111))
+        return -1;
+    batchLane(_sim->bias, _instance) = (_onMask << 3) | _offMask;
+    return 0;
+}
+
+// runs one block of lanes for _ticks scheduler ticks
+static void batchRunBlock(BatchSim *_sim, int _block, uint32_t _ticks) {
+    const BatchVector _pattern = _sim->pattern[_block];
+    const BatchVector _length = _sim->length[_block];
+    const BatchVector _bias = _sim->bias[_block];
+    const BatchVector _isRandom = (BatchVector)(_length == 0);
+    const BatchVector _onMask = _bias >> 3;
+    const BatchVector _offMask = _bias & 0b111;
+    BatchVector _stage = _sim->stage[_block];
+    BatchSigned _remaining = (BatchSigned)_sim->remaining[_block];
+    BatchVector _since = _sim->since[_block];
+    BatchVector _shown = _sim->shown[_block];
+    BatchVector _random = _sim->random[_block];
+
+    for (uint32_t t = 0; t < _ticks; t++, _remaining -= batchTickMicros, _since += 1) {
+        BatchVector _due = (BatchVector)(_remaining <= 0);
+        if (!batchAny(_due))
+            continue;
+
+        // the time the old output was shown
+        for (int s = 0; s < 8; s++)
+            _sim->ticksIn[s][_block] += _since & _due & (BatchVector)(_shown == (uint32_t)s);
+        _since &= ~_due;
+
+        BatchVector _next = _stage + 1;
+        _next &= (BatchVector)(_next < _length); // back to the start, random lanes stay on 0
+        _stage = (_next & _due) | (_stage & ~_due);
+
+        BatchVector _rolled = _random;
+        _rolled ^= _rolled << 13;
+        _rolled ^= _rolled >> 17;
+        _rolled ^= _rolled << 5;
+        _random = (_rolled & _due & _isRandom) | (_random & ~(_due & _isRandom));
+
+        BatchVector _step = ((_pattern >> (_next * 3)) & ~_isRandom) | (_rolled & _isRandom);
+        BatchVector _output = ((_step & 0b111) | _onMask) & _offMask;
+        _shown = (_output & _due) | (_shown & ~_due);
+
+        BatchVector _micros = _sim->stepMicros[0][_block];
+        for (int k = 1; k < maxSequenceSteps; k++) {
+            BatchVector _match = (BatchVector)(_next == (uint32_t)k);
+            _micros = (_sim->stepMicros[k][_block] & _match) | (_micros & ~_match);
+        }
+        BatchVector _multiple = 1 + ((((_rolled >> 3) & 0xFFFF) * PARTY_MAX_STEPS) >> 16);
+        _micros = (_micros * _multiple & _isRandom) | (_micros & ~_isRandom);
+
+        // skip any whole steps we were too late for, as the scheduler does
+        BatchSigned _reload = (BatchSigned)(_micros & _due);
+        _remaining += _reload;
+        for (BatchVector _late = (BatchVector)(_remaining <= 0); batchAny(_late); _late = (BatchVector)(_remaining <= 0))
+            _remaining += _reload & (BatchSigned)_late;
+    }
+
+    for (int s = 0; s < 8; s++)
+        _sim->ticksIn[s][_block] += _since & (BatchVector)(_shown == (uint32_t)s);
+    _sim->stage[_block] = _stage;
+    _sim->remaining[_block] = (BatchVector)_remaining;
+    _sim->since[_block] = BatchVector{};
+    _sim->shown[_block] = _shown;
+    _sim->random[_block] = _random;
+}
+
+void batchRun(BatchSim *_sim, uint32_t _ticks) {
+    for (int b = 0; b < _sim->blocks; b++)
+        batchRunBlock(_sim, b, _ticks);
+}
+
+int batchShown(const BatchSim *_sim, int _instance) {
+    return batchLane(_sim->shown, _instance);
+}
+
+uint32_t batchTicksIn(const BatchSim *_sim, int _instance, int _output) {
+    return batchLane(_sim->ticksIn[_output & 0b111], _instance);
 }
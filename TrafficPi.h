@@ -0,0 +1,221 @@
+#ifndef TRAFFICPI_H
+#define TRAFFICPI_H
+
+#include <stdint.h>
+#include "GpioBackend.h"
+
+/*
+ * PROGRAM OVERVIEW
+ * 	Each control input is set up with an Alert function which sets the
+ * 		interval the lights will change and the step taken after each
+ * 		iteration. One scheduler timer steps every head on its own
+ * 		deadline, see SCHEDULER in TrafficPi.cpp.
+ * 		The end result is a responsive system that uses a simple method
+ * 		to change the current light.
+ * 	All hardware access goes through a GpioBackend (GpioBackend.h), pigpio
+ * 		on the Pi or a simulated bank for running off the Pi.
+ * 	TrafficPi.cpp holds the controller, TrafficPiMain.cpp runs it on the Pi
+ * 		and TrafficPiBench.cpp runs it against the simulated backend.
+ * 	With -w the timer is replaced by a DMA wave, see WAVE PLAYBACK in TrafficPi.cpp.
+ * 	With -l latency is measured and printed on SIGUSR1, see LATENCY in TrafficPi.cpp.
+ * 	With -n commands and telemetry go over a socket, see ControlSocket.h.
+ * 	With -M metrics are served for Prometheus, see MetricsExporter.h.
+ * 	With -e every edge and lamp change is logged to a mapped file, see EventLog.h.
+ * 	With -z slow flashing runs in a low power state, see LOW POWER in TrafficPi.cpp.
+ * 	With -g a hardware watchdog is fed while the scheduler ticks, see WATCHDOG
+ * 		in TrafficPi.cpp.
+ * 	With -x a compiled sequence program replaces the built in sequences, see
+ * 		SequenceProgram.h.
+*/
+
+/*
+    CHANGE SPEED VALUES HERE
+    (time between changes in milliseconds)
+    these are the built in profiles, a profile file loaded with -t can
+    change them without a rebuild, see TIMING PROFILES in TrafficPi.cpp
+*/
+#define slowSpeed 5000 // 5 seconds
+#define mediumSpeed 2000 // 2 seconds
+#define fastSpeed 1000 // 1 second
+// how often the scheduler checks for due steps, steps land within this of their deadline
+#define schedulerResolution 10 // milliseconds
+
+/*
+TrafficPi control settings:
+(left -> right)
+
+0) random (party mode, random pattern and time each step)
+1) downwards roation slow
+2) downwards rotation medium
+3) downwards rotation fast
+4) upwards rotation slow
+5) upwards rotation medium
+6) upwards rotation fast
+7) flashing slow
+8) flashing medium
+9) flashing fast
+*/
+
+/*
+ ***************************************
+ ******** GPIO port connections ********
+ ***************************************
+ * 	Connection		 GPIO	Connection
+ * 	[3V3]			-	-	[5V]
+ * 	redLight		2	-	[5V]
+ * 	amberLight		3	-	[GROUND]
+ * 	greenLight		4	14
+ * 	[GROUND]		-	15
+ * 	redBiasOn		17	18
+ * 	redBiasOff		27	-	[GROUND]
+ * 	amberBiasOn		22	23	preemptPin
+ * 	[GROUND]		-	24
+ * 	amberBiasOff		10	-	[GROUND]
+ * 	greenBiasOn		9	25
+ * 	greenBiasOff		11	8
+ * 	[GROUND]		-	7
+ * 	modeRand		0	1
+ * 	modeDownSlow		5	-	[GROUND]
+ * 	modeDownMedium		6	12	modeUpFast
+ * 	modeDownFast		13	-	[GROUND]
+ * 	modeUpSlow		19	16	modeFlashSlow
+ * 	modeUpMedium		26	20	modeFlashMedium
+ * 	[GROUND]		-	21	modeFlashFast
+*/
+
+#define redLight 2
+#define amberLight 3
+#define greenLight 4
+
+#define redOnBias 17
+#define redOffBias 27
+#define amberOnBias 22
+#define amberOffBias 10
+#define greenOnBias 9
+#define greenOffBias 11
+
+#define modeRand 0
+#define modeDownSlow 5
+#define modeDownMedium 6
+#define modeDownFast 13
+#define modeUpSlow 19
+#define modeUpMedium 26
+#define modeUpFast 12
+#define modeFlashSlow 16
+#define modeFlashMedium 20
+#define modeFlashFast 21
+
+// emergency preemption, held low to show green on preemptHead and red on the rest
+#define preemptPin 23 // -1 for none
+#define preemptHead 0 // position in the pin map
+
+/*
+    CHANGE DEBOUNCE VALUES HERE
+    glitch times are how long (microseconds) a level must be steady before
+    pigpio reports it. The settle time (milliseconds) is how long the mode
+    dial must be quiet before the new mode is applied.
+*/
+#define modeGlitchTime 5000 // 5 ms
+#define biasGlitchTime 2000 // 2 ms
+#define modeSettleTime 50 // 50 ms
+#define preemptGlitchTime 1000 // 1 ms, adds straight onto preemption latency
+
+/*
+    CHANGE FAULT VALUES HERE
+    lamp feedback is only used by heads with sense pins in their pin map
+*/
+#define feedbackPeriod 50 // ms between samples of the lamp sense inputs
+#define faultSamples 3 // samples in a row a lit lamp must read dark to have failed
+#define faultFlashSpeed 1000 // ms each half of the safe flashing after a red lamp fails
+
+/*
+    CHANGE LOW POWER VALUES HERE
+    used with -z, see LOW POWER in TrafficPi.cpp
+*/
+#define lowPowerStepMillis slowSpeed // flashing with steps this long or longer is night running
+#define lowPowerResolution 100 // ms between scheduler passes at night
+#define lowPowerFeedbackPeriod 500 // ms between lamp feedback samples at night
+
+/*
+    CHANGE WATCHDOG VALUES HERE
+    the safe state is sent if the scheduler stops ticking, see WATCHDOG in TrafficPi.cpp
+*/
+#define watchdogPeriod 100 // ms between checks of the scheduler heartbeat
+#define watchdogTimeout 500 // ms without a tick before the lights are forced to the safe state
+#define watchdogSafeFlash 1 // 1 flashes every light at faultFlashSpeed, 0 holds every red on
+
+/*
+ * Controller interface used by TrafficPiMain.cpp and TrafficPiBench.cpp
+*/
+extern bool Wave_Playback; // -w, play sequences as DMA waves
+extern bool Measure_Latency; // -l, record latency histograms
+extern bool Low_Power; // -z, slow down on a slow flashing mode
+
+int loadHeads(const char *_path); // -p, read the pin map of every head, -1 on failure
+int loadProfiles(const char *_path); // -t and SIGHUP, read the timing profiles, -1 on failure and the old ones are kept
+int loadProgram(const char *_path); // -x and SIGHUP, map a compiled sequence program, -1 on failure and the old one is kept
+void setup(void); // configure the pins and start the light cycle, Gpio must be set
+int openHardwareWatchdog(const char *_path); // -g, fed while the scheduler ticks, -1 on failure
+void closeHardwareWatchdog(void); // disarms it, before teardown()
+void teardown(void); // stop the light cycle
+
+// alert callbacks
+void updateOnBias(int _pin, int _level, uint32_t _tick);
+void updateOffBias(int _pin, int _level, uint32_t _tick);
+void updateTimerMode(int _pin, int _level, uint32_t _tick);
+void debounceMode(int _pin, int _level, uint32_t _tick);
+void updatePreempt(int _pin, int _level, uint32_t _tick);
+
+// one set of lights and its bias switches, see LIGHT HEADS in TrafficPi.cpp
+struct LightHead;
+
+// define a type (functions given a head and the BIAS_INDEX of its state snapshot)
+typedef void (*DirectionFunction) (LightHead &_head, int _biasIndex);
+void RotateDown(LightHead &_head, int _biasIndex);
+void RotateUp(LightHead &_head, int _biasIndex);
+void RotateNone(LightHead &_head, int _biasIndex);
+void RotateRandom(LightHead &_head, int _biasIndex);
+
+// takes one step on every head and writes all their lights at once
+void stepHeads(DirectionFunction _direction);
+
+// timer callback
+void sequenceTick(void);
+
+void printLatencyReport(void);
+
+/*
+ * Commands from the network, see COMMAND QUEUE in TrafficPi.cpp
+*/
+#define commandMode 1 // value = dial position whose profile to run
+#define commandBias 2 // head, value = BIAS_ON_MASK, value2 = BIAS_OFF_MASK
+struct ControlCommand {
+    int type;
+    int head;
+    int value;
+    int value2;
+};
+
+// hands a command to the timer callback, 0 queued, -1 not valid, -2 queue full
+// only one thread may queue commands
+int queueCommand(const ControlCommand &_command);
+int formatTelemetry(char *_buffer, int _size); // one line of the published state, see TrafficPi.cpp
+int formatMetrics(char *_buffer, int _size); // counters and state as Prometheus text, see METRICS in TrafficPi.cpp
+
+/*
+ * Many controllers simulated at once for planning, see BATCH SIMULATION in TrafficPi.cpp
+ * Instances are numbered from 0, changes take effect at the instance's next step.
+*/
+#define batchLanes 8 // instances in one vector, 8 x 32 bits is an AVX2 register or two NEON ones
+struct BatchSim;
+BatchSim *batchCreate(int _count); // instances start like a fresh head, NULL if out of memory
+void batchDestroy(BatchSim *_sim);
+// rotation is down, up, flash or random, durations as in a profile file, -1 if not valid
+int batchSetProfile(BatchSim *_sim, int _instance, const char *_rotation, const uint32_t *_stepMillis, int _stepCount);
+int batchSetPosition(BatchSim *_sim, int _instance, int _position); // the active profile of a dial position
+int batchSetBias(BatchSim *_sim, int _instance, int _onMask, int _offMask);
+void batchRun(BatchSim *_sim, uint32_t _ticks); // every instance on _ticks of schedulerResolution
+int batchShown(const BatchSim *_sim, int _instance); // output pattern (red << amber << green)
+uint32_t batchTicksIn(const BatchSim *_sim, int _instance, int _output); // ticks spent showing an output pattern
+
+#endif
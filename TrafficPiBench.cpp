@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <chrono>
+#include "TrafficPi.h"
+#include "SimBackend.h"
+#include "EventLog.h"
+#include "SequenceProgram.h"
+
+/*
+ * Runs the controller against the simulated backend and reports what the
+ * tick and edge paths cost on this machine.
+ * build: g++ -O2 -std=c++17 TrafficPiBench.cpp TrafficPi.cpp SimBackend.cpp EventLog.cpp -o TrafficPiBench
+ * 	add -march=native (or -mavx2) on x86 for the vector batch simulation
+ * usage: TrafficPiBench [iterations] [pinmap]
+*/
+
+typedef std::chrono::steady_clock BenchClock;
+
+void report(const char *_name, BenchClock::time_point _start, long _count, const char *_unit) {
+    double _ns = std::chrono::duration<double, std::nano>(BenchClock::now() - _start).count();
+    printf("%-24s %10.1f ns/%s\n", _name, _ns / _count, _unit);
+}
+
+// steps every head with a direction function, the cost of one step with no timer around it
+void benchDirection(const char *_name, DirectionFunction _function, long _iterations) {
+    BenchClock::time_point _start = BenchClock::now();
+    for (long i = 0; i < _iterations; i++)
+        stepHeads(_function);
+    report(_name, _start, _iterations, "tick");
+}
+
+int main(int argc, char **argv)
+{
+    long iterations = argc > 1 ? atol(argv[1]) : 1000000;
+    if (iterations <= 0) {
+        printf("usage: %s [iterations] [pinmap]\n", argv[0]);
+        return 1;
+    }
+    if (argc > 2 && loadHeads(argv[2]) < 0)
+        return 1;
+
+    Gpio = &SimulatedBackend;
+    Gpio->initialise();
+    simSetLevel(preemptPin, 1); // the sim has no pull ups, an input left low would read as a preemption
+    setup();
+    printf("%ld iterations on the %s backend\n", iterations, Gpio->name);
+
+    benchDirection("RotateDown", RotateDown, iterations);
+    benchDirection("RotateUp", RotateUp, iterations);
+    benchDirection("RotateNone", RotateNone, iterations);
+    benchDirection("RotateRandom", RotateRandom, iterations);
+
+    // the full timer path, one scheduler pass per schedulerResolution of the virtual clock
+    updateTimerMode(modeDownFast, 1, Gpio->tick());
+    BenchClock::time_point start = BenchClock::now();
+    simAdvance((uint64_t)iterations * schedulerResolution * 1000);
+    report("sequenceTick (sim)", start, iterations, "tick");
+
+    // bias switch edges, each one resamples the bank and publishes the state
+    start = BenchClock::now();
+    for (long i = 0; i < iterations; i++)
+        simSetLevel(redOnBias, i & 1);
+    report("bias edge", start, iterations, "edge");
+
+    // settled mode changes, straight into updateTimerMode()
+    start = BenchClock::now();
+    for (long i = 0; i < iterations; i++)
+        updateTimerMode((i & 1) ? modeUpFast : modeDownFast, 1, Gpio->tick());
+    report("updateTimerMode", start, iterations, "edge");
+
+    // a switch storm on the mode dial, bursts of edges then the settle window
+    long edges = 0;
+    start = BenchClock::now();
+    while (edges < iterations) {
+        for (int i = 0; i < 10; i++, edges++)
+            simSetLevel((i & 1) ? modeUpSlow : modeDownSlow, i & 1);
+        simAdvance((modeSettleTime + 1) * 1000);
+    }
+    report("mode dial storm", start, edges, "edge");
+
+    // the same bias edges and light steps again with every event logged
+    char logPath[] = "/tmp/TrafficPiBench.XXXXXX";
+    int logFile = mkstemp(logPath);
+    if (logFile >= 0 && openEventLog(logPath) == 0) {
+        start = BenchClock::now();
+        for (long i = 0; i < iterations; i++)
+            simSetLevel(redOnBias, i & 1);
+        report("bias edge (logged)", start, iterations, "edge");
+        benchDirection("RotateDown (logged)", RotateDown, iterations);
+        closeEventLog();
+    }
+    if (logFile >= 0) {
+        close(logFile);
+        unlink(logPath);
+    }
+
+    // planning simulation, every dial position across a few thousand instances
+    BatchSim *batch = batchCreate(4096);
+    if (batch) {
+        for (int i = 0; i < 4096; i++) {
+            batchSetPosition(batch, i, i % 10);
+            batchSetBias(batch, i, i & 0b111, 0b111);
+        }
+        long ticks = iterations / 100 + 1;
+        start = BenchClock::now();
+        batchRun(batch, ticks);
+        double seconds = std::chrono::duration<double>(BenchClock::now() - start).count();
+        report("batchRun", start, ticks * 4096, "instance-tick");
+        printf("%-24s %10.1f M instance-ticks/s\n", "", ticks * 4096 / seconds / 1e6);
+        batchDestroy(batch);
+    }
+
+    // the longest step a profile may have, timed by the signed lane arithmetic
+    batch = batchCreate(1);
+    if (batch) {
+        const uint32_t longSteps[] = { maxStepMillis, 3000, 25000 };
+        const uint32_t tooLong[] = { maxStepMillis + 1 };
+        const uint32_t longTicks = maxStepMillis / schedulerResolution;
+        bool refused = batchSetProfile(batch, 0, "down", tooLong, 1) < 0;
+        batchSetProfile(batch, 0, "down", longSteps, 3);
+        batchRun(batch, longTicks); // red the whole time
+        bool held = batchShown(batch, 0) == 0b100 && batchTicksIn(batch, 0, 0b100) == longTicks;
+        batchRun(batch, 1);
+        bool stepped = batchShown(batch, 0) == 0b010;
+        batchDestroy(batch);
+        printf("%-24s %s\n", "batch long step", refused && held && stepped ? "ok" : "FAILED");
+        if (!(refused && held && stepped))
+            return 1;
+    }
+
+    teardown();
+    Gpio->terminate();
+    return 0;
+}
@@ -0,0 +1,301 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <time.h>
+#include "TrafficPi.h"
+#include "PigpioBackend.h"
+#include "PigpiodBackend.h"
+#include "ControlSocket.h"
+#include "MetricsExporter.h"
+#include "EventLog.h"
+
+/*
+ * Runs the controller on the Pi with the pigpio backend, or with -d through
+ * a pigpiod daemon (see PigpiodBackend.h) which needs no root.
+ * build: g++ -O2 -std=c++17 TrafficPiMain.cpp TrafficPi.cpp PigpioBackend.cpp PigpiodBackend.cpp ControlSocket.cpp MetricsExporter.cpp EventLog.cpp -o TrafficPi -lpigpio -lpigpiod_if2 -lpthread
+ * The main thread does no work of its own, it sleeps in sigwait() until
+ * 	SIGINT or SIGTERM arrives and then shuts pigpio down cleanly.
+ * 	SIGHUP reads the -t timing profiles and -x program again without
+ * 	stopping the lights.
+*/
+
+/*
+ * Blocks the signals main() waits for in the calling thread. Must be called
+ * before gpioInitialise() so every thread pigpio starts inherits the same
+ * mask and the signals are only ever delivered to sigwait() in main().
+ * SIGINT/SIGTERM shut down, SIGUSR1 prints the latency histograms and CPU use,
+ * SIGHUP reloads the timing profiles and sequence program.
+*/
+void blockControlSignals(sigset_t *_signals) {
+    sigemptyset(_signals);
+    sigaddset(_signals, SIGINT);
+    sigaddset(_signals, SIGTERM);
+    sigaddset(_signals, SIGUSR1);
+    sigaddset(_signals, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, _signals, NULL);
+}
+
+/*
+ * REAL TIME
+ * 	pigpio starts its alert thread in gpioInitialise() and a thread per
+ * 		timer when the timer is set, each one inherits the scheduling
+ * 		policy and CPU affinity of the thread that starts it. So -r and -c
+ * 		are applied to the main thread before pigpio is started and taken
+ * 		off again once setup() has run, leaving only pigpio's threads
+ * 		(the callbacks and so every direction function) on SCHED_FIFO and
+ * 		the chosen core. Threads started later, like the control socket,
+ * 		run normally.
+ * 	-m locks every page of the process in memory, now and later, so a page
+ * 		fault can never stall a light change.
+ * 	Each setting that could not be applied is reported and the program
+ * 		carries on without it, e.g. when not run as root.
+*/
+#define noRealtime -1
+
+cpu_set_t Startup_Cpus; // affinity before -c, put back on the main thread afterwards
+
+void applyRealtime(int _priority, int _cpu, bool _lockMemory) {
+    if (_lockMemory) {
+        if (mlockall(MCL_CURRENT | MCL_FUTURE) == 0)
+            printf("realtime: memory locked\n");
+        else
+            printf("realtime: could not lock memory (%s)\n", strerror(errno));
+    }
+
+    if (_priority != noRealtime) {
+        sched_param _param = {};
+        _param.sched_priority = _priority;
+        int _result = pthread_setschedparam(pthread_self(), SCHED_FIFO, &_param);
+        if (_result == 0)
+            printf("realtime: callbacks on SCHED_FIFO priority %d\n", _priority);
+        else
+            printf("realtime: could not use SCHED_FIFO priority %d (%s)\n", _priority, strerror(_result));
+    }
+
+    pthread_getaffinity_np(pthread_self(), sizeof(Startup_Cpus), &Startup_Cpus);
+    if (_cpu != noRealtime) {
+        cpu_set_t _cpus;
+        CPU_ZERO(&_cpus);
+        CPU_SET(_cpu, &_cpus);
+        int _result = pthread_setaffinity_np(pthread_self(), sizeof(_cpus), &_cpus);
+        if (_result == 0)
+            printf("realtime: callbacks pinned to cpu %d\n", _cpu);
+        else
+            printf("realtime: could not pin to cpu %d (%s)\n", _cpu, strerror(_result));
+    }
+}
+
+/*
+ * CPU used by the whole process (pigpio's threads included) since the
+ * last report, printed with the latency on SIGUSR1 to compare input modes.
+*/
+timespec Report_Time;
+double Report_Cpu = 0; // seconds
+
+double processCpu(void) {
+    rusage _usage;
+    getrusage(RUSAGE_SELF, &_usage);
+    return _usage.ru_utime.tv_sec + _usage.ru_stime.tv_sec
+        + (_usage.ru_utime.tv_usec + _usage.ru_stime.tv_usec) / 1e6;
+}
+
+void printCpuReport(void) {
+    timespec _now;
+    clock_gettime(CLOCK_MONOTONIC, &_now);
+    double _cpu = processCpu();
+    double _wall = (_now.tv_sec - Report_Time.tv_sec) + (_now.tv_nsec - Report_Time.tv_nsec) / 1e9;
+    if (_wall > 0)
+        printf("cpu: %.2f%% of one core over %.1f s\n", 100 * (_cpu - Report_Cpu) / _wall, _wall);
+    Report_Time = _now;
+    Report_Cpu = _cpu;
+}
+
+// puts the main thread back to normal scheduling once pigpio's threads are running
+void leaveRealtime(void) {
+    sched_param _param = {};
+    pthread_setschedparam(pthread_self(), SCHED_OTHER, &_param);
+    pthread_setaffinity_np(pthread_self(), sizeof(Startup_Cpus), &Startup_Cpus);
+}
+
+
+int main(int argc, char **argv)
+{
+	const char *profilePath = NULL;
+	int option;
+	const char *controlAddress = NULL;
+	const char *metricsPort = NULL;
+	int priority = noRealtime;
+	int cpu = noRealtime;
+	bool lockMemory = false;
+	int input = inputAlerts;
+	unsigned sampleRate = defaultSampleRate;
+	const char *daemonAddress = NULL;
+	const char *programPath = NULL;
+	const char *watchdogPath = NULL;
+	while ((option = getopt(argc, argv, "wlzp:t:n:M:e:r:c:mi:s:d:x:g:")) != -1) {
+		switch (option)
+		{
+		case 'w': // play sequences as DMA waves instead of timer callbacks
+			Wave_Playback = true;
+			break;
+		case 'z': // low power while the dial is on slow flashing
+			Low_Power = true;
+			break;
+		case 'l': // measure latency, printed on SIGUSR1
+			Measure_Latency = true;
+			break;
+		case 'p': // pin map of every light head
+			if (loadHeads(optarg) < 0)
+				return 1;
+			break;
+		case 't': // timing profiles, read again on SIGHUP
+			profilePath = optarg;
+			if (loadProfiles(profilePath) < 0)
+				return 1;
+			break;
+		case 'e': // memory mapped event log, read it with EventLogDump
+			if (openEventLog(optarg) < 0)
+				return 1;
+			break;
+		case 'n': // UDP port or Unix socket path for network commands
+			controlAddress = optarg;
+			break;
+		case 'r': // SCHED_FIFO priority of the callback threads
+			priority = atoi(optarg);
+			if (priority < sched_get_priority_min(SCHED_FIFO) || priority > sched_get_priority_max(SCHED_FIFO)) {
+				printf("priority must be %d to %d\n", sched_get_priority_min(SCHED_FIFO), sched_get_priority_max(SCHED_FIFO));
+				return 1;
+			}
+			break;
+		case 'c': // core to pin the callback threads to
+			cpu = atoi(optarg);
+			if (cpu < 0 || cpu >= CPU_SETSIZE) {
+				printf("bad cpu %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'm': // lock the process in memory
+			lockMemory = true;
+			break;
+		case 'i': // how input edges are delivered, see PigpioBackend.h
+			if (strcmp(optarg, "alert") == 0)
+				input = inputAlerts;
+			else if (strcmp(optarg, "isr") == 0)
+				input = inputInterrupts;
+			else if (strcmp(optarg, "samples") == 0)
+				input = inputSamples;
+			else {
+				printf("input must be alert, isr or samples\n");
+				return 1;
+			}
+			break;
+		case 's': // pigpio sample rate in microseconds
+			sampleRate = atoi(optarg);
+			break;
+		case 'x': // compiled sequence program, mapped again on SIGHUP
+			programPath = optarg;
+			if (loadProgram(programPath) < 0)
+				return 1;
+			break;
+		case 'M': // serve Prometheus metrics on a TCP port
+			metricsPort = optarg;
+			break;
+		case 'g': // hardware watchdog device to feed, e.g. /dev/watchdog
+			watchdogPath = optarg;
+			break;
+		case 'd': // drive the pins through a pigpiod daemon, host[:port]
+			daemonAddress = optarg;
+			break;
+		default:
+			printf("usage: %s [-w] [-l] [-z] [-p pinmap] [-t profiles] [-n port|path] [-M port] [-e eventlog] [-r priority] [-c cpu] [-m] [-i alert|isr|samples] [-s micros] [-d host[:port]] [-x program] [-g watchdog]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	sigset_t controlSignals;
+	blockControlSignals(&controlSignals);
+	applyRealtime(priority, cpu, lockMemory);
+
+	if (pigpioConfigure(input, sampleRate) < 0) {
+		printf("sample rate must be 1, 2, 4, 5, 8 or 10 microseconds\n");
+		return 1;
+	}
+	Gpio = &PigpioBackend;
+	char daemonHost[256];
+	if (daemonAddress) {
+		// -i and -s are set on the daemon's own command line instead
+		snprintf(daemonHost, sizeof(daemonHost), "%s", daemonAddress);
+		char *port = strchr(daemonHost, ':');
+		if (port)
+			*port++ = '\0';
+		pigpiodConfigure(daemonHost, port);
+		Gpio = &PigpiodBackend;
+	}
+	if (Gpio->initialise() < 0) {
+		printf("setup %s failed\n", Gpio->name);
+		return 1;
+	}
+	setup();
+	leaveRealtime();
+	clock_gettime(CLOCK_MONOTONIC, &Report_Time);
+	Report_Cpu = processCpu();
+	if (programPath && Wave_Playback)
+		printf("sequence programs are not used with -w, the built in sequences are played\n");
+	if (watchdogPath && Wave_Playback)
+		printf("the watchdog is not used with -w, there is no scheduler to watch\n");
+	else if (watchdogPath && openHardwareWatchdog(watchdogPath) < 0) {
+		teardown();
+		Gpio->terminate();
+		return 1;
+	}
+	if (controlAddress) {
+		if (Wave_Playback)
+			printf("network commands have no effect with -w, only telemetry is sent\n");
+		if (startControlSocket(controlAddress) < 0) {
+			closeHardwareWatchdog();
+			teardown();
+			Gpio->terminate();
+			return 1;
+		}
+	}
+	if (metricsPort && startMetrics(metricsPort) < 0) {
+		stopControlSocket();
+		closeHardwareWatchdog();
+		teardown();
+		Gpio->terminate();
+		return 1;
+	}
+
+	// this is an interrupt based program, all the work happens in the
+	// alert and timer callbacks so just sleep until we are told to stop
+	int caught = 0;
+	while (sigwait(&controlSignals, &caught) == 0 && caught != SIGINT && caught != SIGTERM) {
+		if (caught == SIGUSR1) {
+			printLatencyReport();
+			printCpuReport();
+		}
+		else if (caught == SIGHUP) {
+			if (profilePath && loadProfiles(profilePath) == 0)
+				printf("reloaded timing profiles from %s\n", profilePath);
+			if (programPath && loadProgram(programPath) == 0)
+				printf("reloaded sequence program from %s\n", programPath);
+		}
+		fflush(stdout);
+	}
+
+	stopMetrics();
+	stopControlSocket();
+	closeHardwareWatchdog();
+	teardown();
+	Gpio->terminate();
+	closeEventLog();
+
+	return 0;
+}
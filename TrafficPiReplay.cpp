@@ -0,0 +1,342 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <chrono>
+#include "TrafficPi.h"
+#include "SimBackend.h"
+#include "EventLog.h"
+
+/*
+ * Replays the inputs recorded in a TrafficPi -e event log through the
+ * controller on the simulated backend, as fast as it will go, and checks the
+ * lamp changes it makes against a golden log.
+ * build: g++ -O2 -std=c++17 TrafficPiReplay.cpp TrafficPi.cpp SimBackend.cpp EventLog.cpp -o TrafficPiReplay
+ * usage: TrafficPiReplay <trace> [-o output] [-g golden] [-t micros] [-p pinmap]
+ * 	trace	an event log from the field or any other run, the simulated
+ * 		inputs are set to the levels of its startup record before the
+ * 		controller is set up, then its later mode, bias and preempt
+ * 		records are the inputs, each is handed to the same callback it
+ * 		reached when it was recorded, a mode record as a dial edge that
+ * 		settles through debounceMode() as it did live
+ * 	-o	event log of the replay itself, the same inputs and the lamp
+ * 		changes they made, keep one as the golden for later runs
+ * 	-g	log whose lamp changes the replay must match, exits 1 if not
+ * 	-t	how far (us) a lamp change may be from the golden one, default
+ * 		one scheduler pass
+ * 	Times in each log are taken from its first record, the startup record
+ * 		when the controller started with the log. The replay starts from
+ * 		a freshly set up controller, so a field log is only a fair golden
+ * 		if the controller was started with the log and its ring has not
+ * 		wrapped, without a startup record every input starts low but the
+ * 		preemption.
+ * 	Reports what each kind of input and each scheduler pass cost.
+*/
+#define maxTraceEvents eventLogRecords
+
+typedef std::chrono::steady_clock ReplayClock;
+
+// a record copied out of a log
+struct TraceEvent {
+    uint32_t tick;
+    uint32_t bits;
+    uint8_t type;
+    uint8_t pin;
+    uint8_t level;
+    uint8_t value;
+};
+
+struct EventLogFile {
+    TraceEvent events[maxTraceEvents];
+    int count;
+    int firstInput; // index of the first mode, bias or preempt record, -1 if there is none
+    int startup; // index of the startup record, -1 if there is none
+    uint32_t base; // tick times are taken from, the first record's
+};
+
+EventLogFile Trace, Output, Golden;
+int Input_Order[maxTraceEvents]; // trace inputs by time, see main()
+int Dial_Pin = -1; // mode pin the replay holds high, -1 before the first mode record
+
+bool isInput(const TraceEvent &_event) {
+    return _event.type == eventMode || _event.type == eventOnBias || _event.type == eventOffBias
+        || _event.type == eventPreempt;
+}
+
+// copies every record still in the ring, oldest first, -1 if it is not an event log
+int readLog(const char *_path, EventLogFile &_log) {
+    int _fd = open(_path, O_RDONLY);
+    size_t _bytes = sizeof(EventLogHeader) + eventLogRecords * sizeof(EventRecord);
+    void *_map = _fd >= 0 ? mmap(NULL, _bytes, PROT_READ, MAP_SHARED, _fd, 0) : MAP_FAILED;
+    if (_fd >= 0)
+        close(_fd);
+    if (_map == MAP_FAILED) {
+        printf("could not map %s\n", _path);
+        return -1;
+    }
+    const EventLogHeader *_header = (const EventLogHeader *)_map;
+    if (memcmp(_header->magic, eventLogMagic, sizeof(_header->magic)) != 0
+        || _header->recordSize != sizeof(EventRecord) || _header->recordCount != eventLogRecords) {
+        printf("%s is not an event log from this build\n", _path);
+        munmap(_map, _bytes);
+        return -1;
+    }
+    const EventRecord *_records = (const EventRecord *)(_header + 1);
+
+    uint64_t _next = _header->next.load(std::memory_order_acquire);
+    _log.count = 0;
+    _log.firstInput = -1;
+    _log.startup = -1;
+    for (uint64_t n = _next > eventLogRecords ? _next - eventLogRecords : 0; n < _next; n++) {
+        EventRecord _record;
+        if (!readEventRecord(_records, n, _record))
+            continue; // torn by a writer still running
+        TraceEvent &_event = _log.events[_log.count];
+        _event = { _record.tick, _record.bits, _record.type, _record.pin, _record.level, _record.value };
+        if (_log.count == 0)
+            _log.base = _event.tick;
+        if (_log.firstInput < 0 && isInput(_event))
+            _log.firstInput = _log.count;
+        if (_log.startup < 0 && _event.type == eventStartup)
+            _log.startup = _log.count;
+        _log.count++;
+    }
+    munmap(_map, _bytes);
+    return 0;
+}
+
+struct Cost {
+    const char *name;
+    long count;
+    double totalNs;
+    double maxNs;
+};
+
+Cost Costs[] = { { "?" }, { "mode" }, { "onBias" }, { "offBias" }, { "lamp" }, { "fault" }, { "watchdog" }, { "preempt" } };
+
+// the edge reaches its callback, through the simulated pin when the level changes
+void feedInput(const TraceEvent &_event) {
+    if (_event.type == eventMode && Gpio->read(_event.pin) != 1) {
+        // the dial is turned then settles through debounceMode() as it did live,
+        // the record's tick is the last edge before it settled
+        if (Dial_Pin >= 0)
+            simSetLevel(Dial_Pin, 0);
+        simSetLevel(_event.pin, 1);
+        Dial_Pin = _event.pin;
+        return;
+    }
+    if (_event.type == eventMode) {
+        updateTimerMode(_event.pin, 1, Gpio->tick()); // already on the dial, e.g. a mode command
+        return;
+    }
+    if (Gpio->read(_event.pin) != _event.level) {
+        simSetLevel(_event.pin, _event.level);
+        return;
+    }
+    GpioAlertFunction _function = _event.type == eventOnBias ? updateOnBias
+        : _event.type == eventOffBias ? updateOffBias : updatePreempt;
+    _function(_event.pin, _event.level, Gpio->tick());
+}
+
+// when a record happened, microseconds from the first record of its log
+int64_t eventTime(const EventLogFile &_log, const TraceEvent &_event) {
+    return (int32_t)(_event.tick - _log.base);
+}
+
+// when to feed a trace record, a mode record with a tick from before the log began is fed at the start
+int64_t replayTime(const TraceEvent &_event) {
+    int64_t _at = eventTime(Trace, _event);
+    return _at < 0 ? 0 : _at;
+}
+
+// true for an input setup() read into the startup record, e.g. the mode it selected from the dial
+bool beforeStartup(const TraceEvent &_event) {
+    return Trace.startup >= 0 && (int32_t)(_event.tick - Trace.events[Trace.startup].tick) <= 0;
+}
+
+// compares the lamp changes, returns how many differ
+int diffLamps(const EventLogFile &_replay, const EventLogFile &_golden, uint32_t _tolerance) {
+    if (_golden.count == 0) {
+        printf("golden log is empty\n");
+        return 1;
+    }
+    int _differences = 0;
+    int _compared = 0;
+    int r = 0, g = 0;
+    for (;;) {
+        while (r < _replay.count && _replay.events[r].type != eventLamp)
+            r++;
+        while (g < _golden.count && _golden.events[g].type != eventLamp)
+            g++;
+        if (r >= _replay.count && g >= _golden.count)
+            break;
+        _compared++;
+        if (r >= _replay.count || g >= _golden.count) {
+            bool _extra = r < _replay.count;
+            const TraceEvent &_event = _extra ? _replay.events[r] : _golden.events[g];
+            if (_differences++ < 10)
+                printf("lamp change %d: head %d bits %08x at %+.6f s only in the %s\n", _compared, _event.pin, _event.bits,
+                    eventTime(_extra ? _replay : _golden, _event) / 1e6, _extra ? "replay" : "golden");
+            r++, g++;
+            continue;
+        }
+        const TraceEvent &_mine = _replay.events[r++];
+        const TraceEvent &_theirs = _golden.events[g++];
+        int64_t _mineAt = eventTime(_replay, _mine);
+        int64_t _theirsAt = eventTime(_golden, _theirs);
+        int64_t _apart = _mineAt > _theirsAt ? _mineAt - _theirsAt : _theirsAt - _mineAt;
+        if (_mine.pin != _theirs.pin || _mine.bits != _theirs.bits || _apart > _tolerance) {
+            if (_differences++ < 10)
+                printf("lamp change %d: head %d bits %08x at %+.6f s, golden head %d bits %08x at %+.6f s\n", _compared,
+                    _mine.pin, _mine.bits, _mineAt / 1e6, _theirs.pin, _theirs.bits, _theirsAt / 1e6);
+        }
+    }
+    if (_differences)
+        printf("%d of %d lamp changes differ from the golden log\n", _differences, _compared);
+    else
+        printf("lamp timeline matches the golden log, %d changes\n", _compared);
+    return _differences;
+}
+
+int main(int argc, char **argv)
+{
+    const char *outputPath = NULL;
+    const char *goldenPath = NULL;
+    uint32_t tolerance = schedulerResolution * 1000;
+    int option;
+    while ((option = getopt(argc, argv, "o:g:t:p:")) != -1) {
+        switch (option)
+        {
+        case 'o':
+            outputPath = optarg;
+            break;
+        case 'g':
+            goldenPath = optarg;
+            break;
+        case 't':
+            tolerance = atoi(optarg);
+            break;
+        case 'p':
+            if (loadHeads(optarg) < 0)
+                return 1;
+            break;
+        default:
+            optind = argc + 1;
+            break;
+        }
+    }
+    if (optind != argc - 1) {
+        printf("usage: %s <trace> [-o output] [-g golden] [-t micros] [-p pinmap]\n", argv[0]);
+        return 1;
+    }
+    if (readLog(argv[optind], Trace) < 0 || (goldenPath && readLog(goldenPath, Golden) < 0))
+        return 1;
+    if (Trace.firstInput < 0 && Trace.startup < 0) {
+        printf("%s has no inputs to replay\n", argv[optind]);
+        return 1;
+    }
+
+    char outputName[] = "/tmp/TrafficPiReplay.XXXXXX";
+    if (!outputPath) {
+        int _fd = mkstemp(outputName);
+        if (_fd < 0) {
+            printf("could not create a temporary event log\n");
+            return 1;
+        }
+        close(_fd);
+    }
+    if (openEventLog(outputPath ? outputPath : outputName) < 0)
+        return 1;
+
+    // the inputs as setup() read them live, no alerts are set yet so these are not edges
+    Gpio = &SimulatedBackend;
+    Gpio->initialise();
+    if (Trace.startup >= 0) {
+        const TraceEvent &startup = Trace.events[Trace.startup];
+        for (int pin = 0; pin < 32; pin++) {
+            if (startup.bits & (1u << pin))
+                simSetLevel(pin, 1);
+        }
+        if (startup.level)
+            Dial_Pin = startup.pin;
+    } else {
+        simSetLevel(preemptPin, 1); // the sim has no pull ups, an input left low would read as a preemption
+    }
+    setup();
+
+    // inputs in time order, a mode record is logged once the dial settles
+    // but carries the tick of its last edge, so it can come after later edges
+    int inputs = 0;
+    int64_t end = 0; // time of the last record of any kind, the replay runs at least that long
+    for (int i = 0; i < Trace.count; i++) {
+        int64_t at = replayTime(Trace.events[i]);
+        if (at > end)
+            end = at;
+        if (!isInput(Trace.events[i]) || beforeStartup(Trace.events[i]))
+            continue; // the lamps and faults are what the replay makes for itself, the startup levels are already set
+        int j = inputs++;
+        for (; j > 0 && replayTime(Trace.events[Input_Order[j - 1]]) > at; j--)
+            Input_Order[j] = Input_Order[j - 1];
+        Input_Order[j] = i;
+    }
+
+    // every input at the same distance from the first as it was recorded
+    uint64_t start = simClock();
+    double schedulerNs = 0;
+    ReplayClock::time_point replayStart = ReplayClock::now();
+    for (int i = 0; i <= inputs; i++) {
+        uint64_t due = start + (i < inputs ? replayTime(Trace.events[Input_Order[i]]) : end);
+        if (due > simClock()) {
+            ReplayClock::time_point before = ReplayClock::now();
+            simAdvance(due - simClock());
+            schedulerNs += std::chrono::duration<double, std::nano>(ReplayClock::now() - before).count();
+        }
+        if (i == inputs)
+            break;
+
+        const TraceEvent &event = Trace.events[Input_Order[i]];
+        ReplayClock::time_point before = ReplayClock::now();
+        feedInput(event);
+        double ns = std::chrono::duration<double, std::nano>(ReplayClock::now() - before).count();
+        Cost &cost = Costs[event.type];
+        cost.count++;
+        cost.totalNs += ns;
+        if (ns > cost.maxNs)
+            cost.maxNs = ns;
+    }
+    ReplayClock::time_point before = ReplayClock::now();
+    simAdvance((modeSettleTime + schedulerResolution) * 1000); // a last mode edge settles, then a scheduler pass
+    schedulerNs += std::chrono::duration<double, std::nano>(ReplayClock::now() - before).count();
+
+    double wall = std::chrono::duration<double>(ReplayClock::now() - replayStart).count();
+    double replayed = (simClock() - start) / 1e6;
+    long passes = (long)((simClock() - start) / (schedulerResolution * 1000));
+    teardown();
+    Gpio->terminate(); // resets the virtual clock
+    closeEventLog();
+
+    printf("replayed %.3f s of inputs from %s in %.3f s, %.0f times real time\n", replayed, argv[optind], wall,
+        wall > 0 ? replayed / wall : 0);
+    for (const Cost &cost : Costs) {
+        if (cost.count)
+            printf("%-10s %8ld events %10.1f ns mean %10.1f ns max\n", cost.name, cost.count, cost.totalNs / cost.count, cost.maxNs);
+    }
+    if (passes)
+        printf("%-10s %8ld passes %10.1f ns mean\n", "scheduler", passes, schedulerNs / passes);
+
+    int result = 0;
+    if (goldenPath) {
+        if (readLog(outputPath ? outputPath : outputName, Output) < 0) {
+            result = 1;
+        } else {
+            Output.base = (uint32_t)start; // where the replay's controller started, even if it logged nothing then
+            if (diffLamps(Output, Golden, tolerance) > 0)
+                result = 1;
+        }
+    }
+    if (!outputPath)
+        unlink(outputName);
+    return result;
+}